@@ -0,0 +1,181 @@
+/*
+ * apex_arena.c
+ * Contains the per-simulation arena. Memory comes in chunks, the first of
+ * which also holds the arena itself, so an arena sized for its run is one
+ * allocation and one release.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "apex_arena.h"
+
+#define ARENA_ALIGN 64
+#define ARENA_PAGE_SIZE 4096
+#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+typedef struct Arena_Chunk
+{
+    struct Arena_Chunk *next;
+    size_t size;   /* Bytes in the chunk, header included */
+    size_t used;
+    int mapped;    /* From mmap rather than calloc */
+} Arena_Chunk;
+
+struct APEX_Arena
+{
+    Arena_Chunk *chunks; /* Newest first, allocations come from the head */
+};
+
+static size_t
+align_up(size_t size, size_t align)
+{
+    return (size + align - 1) & ~(align - 1);
+}
+
+/*
+ * Small chunks come zeroed from calloc. Large ones are mapped, with huge
+ * pages if the host has them reserved, otherwise asking for transparent
+ * ones; either way the kernel zeroes them.
+ */
+static Arena_Chunk *
+chunk_create(size_t size)
+{
+    Arena_Chunk *chunk = NULL;
+    void *mem;
+
+    /* Whole pages leave slack for the alignment of each allocation */
+    size = align_up(size, ARENA_PAGE_SIZE);
+    if (size < ARENA_HUGE_PAGE_SIZE)
+    {
+        if (posix_memalign(&mem, ARENA_ALIGN, size) != 0)
+        {
+            return NULL;
+        }
+        memset(mem, 0, size);
+        chunk = mem;
+        chunk->mapped = 0;
+    }
+    else
+    {
+        size = align_up(size, ARENA_HUGE_PAGE_SIZE);
+        mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+        if (mem == MAP_FAILED)
+        {
+            mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED)
+            {
+                return NULL;
+            }
+#ifdef MADV_HUGEPAGE
+            madvise(mem, size, MADV_HUGEPAGE);
+#endif
+        }
+        chunk = mem;
+        chunk->mapped = 1;
+    }
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = align_up(sizeof(Arena_Chunk), ARENA_ALIGN);
+    return chunk;
+}
+
+static void
+chunk_free(Arena_Chunk *chunk)
+{
+    if (chunk->mapped)
+    {
+        munmap(chunk, chunk->size);
+    }
+    else
+    {
+        free(chunk);
+    }
+}
+
+static void *
+chunk_alloc(Arena_Chunk *chunk, size_t size)
+{
+    void *mem;
+
+    if (chunk->size - chunk->used < size)
+    {
+        return NULL;
+    }
+
+    mem = (char *)chunk + chunk->used;
+    chunk->used += size;
+    return mem;
+}
+
+APEX_Arena *
+APEX_arena_create(size_t size)
+{
+    Arena_Chunk *chunk;
+    APEX_Arena *arena;
+
+    size += align_up(sizeof(Arena_Chunk), ARENA_ALIGN)
+            + align_up(sizeof(APEX_Arena), ARENA_ALIGN);
+    chunk = chunk_create(size);
+    if (!chunk)
+    {
+        return NULL;
+    }
+
+    arena = chunk_alloc(chunk, align_up(sizeof(APEX_Arena), ARENA_ALIGN));
+    arena->chunks = chunk;
+    return arena;
+}
+
+void *
+APEX_arena_alloc(APEX_Arena *arena, size_t size)
+{
+    Arena_Chunk *chunk;
+    void *mem;
+
+    size = align_up(size ? size : 1, ARENA_ALIGN);
+    mem = chunk_alloc(arena->chunks, size);
+    if (mem)
+    {
+        return mem;
+    }
+
+    /* Start a new chunk, at least double the last so growth stays
+     * logarithmic */
+    chunk = chunk_create(align_up(sizeof(Arena_Chunk), ARENA_ALIGN)
+                         + (size > 2 * arena->chunks->size
+                                ? size
+                                : 2 * arena->chunks->size));
+    if (!chunk)
+    {
+        return NULL;
+    }
+
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    return chunk_alloc(chunk, size);
+}
+
+void
+APEX_arena_destroy(APEX_Arena *arena)
+{
+    Arena_Chunk *chunk, *next;
+
+    if (!arena)
+    {
+        return;
+    }
+
+    /* The arena lives in the oldest chunk, which goes last */
+    for (chunk = arena->chunks; chunk; chunk = next)
+    {
+        next = chunk->next;
+        chunk_free(chunk);
+    }
+}
@@ -0,0 +1,26 @@
+/*
+ * apex_arena.h
+ * Contains declarations of the per-simulation arena, a bump allocator that
+ * hands out all the fixed size state of a run and releases it at once
+ */
+#ifndef _APEX_ARENA_H_
+#define _APEX_ARENA_H_
+
+#include <stddef.h>
+
+typedef struct APEX_Arena APEX_Arena;
+
+/*
+ * Creates an arena with room for about size bytes up front; it grows by
+ * further chunks when that runs out. Arenas of a huge page or more are
+ * backed by huge pages where the host has them. Returns NULL on failure.
+ */
+APEX_Arena *APEX_arena_create(size_t size);
+
+/* Returns size zeroed bytes aligned to a cache line, or NULL */
+void *APEX_arena_alloc(APEX_Arena *arena, size_t size);
+
+/* Releases the arena and everything allocated from it */
+void APEX_arena_destroy(APEX_Arena *arena);
+
+#endif
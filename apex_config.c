@@ -0,0 +1,135 @@
+/*
+ * apex_config.c
+ * Contains run-time configuration of an APEX cpu instance, every knob can be
+ * set by name from the command line or from a parameter sweep grid
+ */
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+
+typedef struct Config_Key
+{
+    const char *name;
+    size_t offset;
+    const char *help;
+    int sweep; /* May be an axis of a parameter sweep */
+} Config_Key;
+
+static const Config_Key config_keys[] = {
+    {"forwarding", offsetof(APEX_Config, forwarding),
+     "Forward execute results to decode (0/1)", TRUE},
+    {"debug", offsetof(APEX_Config, debug_messages),
+     "Print stage contents every cycle (0/1)", FALSE},
+    {"single_step", offsetof(APEX_Config, single_step),
+     "Wait for user input after every cycle (0/1)", FALSE},
+    {"quiet", offsetof(APEX_Config, quiet),
+     "Suppress summary and final state dumps (0/1)", FALSE},
+    {"max_cycles", offsetof(APEX_Config, max_cycles),
+     "Stop after this many cycles, 0 for no limit", TRUE},
+    {"occupancy_interval", offsetof(APEX_Config, occupancy_interval),
+     "Cycles per stage occupancy sample of -L", FALSE},
+    {"snapshot_interval", offsetof(APEX_Config, snapshot_interval),
+     "Cycles between live statistics snapshots of -s", FALSE},
+    {"async_log", offsetof(APEX_Config, async_log),
+     "Format debug output on a background thread (0/1)", FALSE},
+    {"registers", offsetof(APEX_Config, registers),
+     "Architectural registers, at most 64", TRUE},
+    {"l1_lines", offsetof(APEX_Config, l1_lines),
+     "Lines per private L1 of a multi-core system (-M)", TRUE},
+    {"bus_latency", offsetof(APEX_Config, bus_latency),
+     "Cycles a bus transaction holds the bus (-M)", TRUE},
+    {"memory_latency", offsetof(APEX_Config, memory_latency),
+     "Extra cycles when memory supplies a line (-M)", TRUE},
+    {"fast_forward", offsetof(APEX_Config, fast_forward),
+     "Instructions to run functionally before the pipeline", TRUE},
+    {"value_prediction", offsetof(APEX_Config, value_prediction),
+     "Count the stalls a stride value predictor removes (0/1)", TRUE},
+    {"trace_start", offsetof(APEX_Config, trace_start),
+     "Record of a -t trace to start the replay at", FALSE},
+};
+
+#define NUM_CONFIG_KEYS (int)(sizeof(config_keys) / sizeof(config_keys[0]))
+
+/*
+ * Fills in the defaults, which match the compile time macros
+ */
+void
+APEX_config_default(APEX_Config *config)
+{
+    memset(config, 0, sizeof(APEX_Config));
+    config->forwarding = TRUE;
+    config->debug_messages = ENABLE_DEBUG_MESSAGES;
+    config->single_step = ENABLE_SINGLE_STEP;
+    config->occupancy_interval = 1000;
+    config->snapshot_interval = 1000000;
+    config->async_log = TRUE;
+    config->registers = REG_FILE_SIZE;
+    config->l1_lines = 64;
+    config->bus_latency = 4;
+    config->memory_latency = 20;
+}
+
+/*
+ * Sets the knob called key from its decimal string value, 0 to INT_MAX.
+ * Returns 0 on success, -1 for an unknown key or a malformed value.
+ */
+int
+APEX_config_set(APEX_Config *config, const char *key, const char *value)
+{
+    int i;
+    long num;
+    char *end;
+
+    for (i = 0; i < NUM_CONFIG_KEYS; ++i)
+    {
+        if (strcmp(config_keys[i].name, key) == 0)
+        {
+            num = strtol(value, &end, 10);
+            if (end == value || *end != '\0' || num < 0 || num > INT_MAX)
+            {
+                return -1;
+            }
+
+            *(int *)((char *)config + config_keys[i].offset) = (int)num;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Returns TRUE if key may be an axis of a parameter sweep. Knobs for
+ * interactive use or extra output are not: sweep points run headless.
+ */
+int
+APEX_config_sweepable(const char *key)
+{
+    int i;
+
+    for (i = 0; i < NUM_CONFIG_KEYS; ++i)
+    {
+        if (strcmp(config_keys[i].name, key) == 0)
+        {
+            return config_keys[i].sweep;
+        }
+    }
+
+    return FALSE;
+}
+
+void
+APEX_config_print_keys(FILE *fp)
+{
+    int i;
+
+    for (i = 0; i < NUM_CONFIG_KEYS; ++i)
+    {
+        fprintf(fp, "    %-14s %s\n", config_keys[i].name, config_keys[i].help);
+    }
+}
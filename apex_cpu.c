@@ -6,17 +6,17 @@
  * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
  * State University of New York at Binghamton
  */
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 
+#include "apex_arena.h"
 #include "apex_cpu.h"
 #include "apex_macros.h"
-
-int scoreBoard[16] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0};
-int collection[16] = {-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1};
-bool stall = FALSE;
+#include "apex_system.h"
+#include "apex_translate.h"
 
 /* Converts the PC(4000 series) into array index for code memory
  *
@@ -29,9 +29,10 @@ get_code_memory_index_from_pc(const int pc)
 }
 
 static void
-print_instruction(const CPU_Stage *stage)
+print_instruction(FILE *fp, const APEX_Instruction *ins,
+                  const char *opcode_str)
 {
-    switch (stage->opcode)
+    switch (ins->opcode)
     {
         case OPCODE_ADD:
         case OPCODE_SUB:
@@ -41,43 +42,43 @@ print_instruction(const CPU_Stage *stage)
         case OPCODE_OR:
         case OPCODE_XOR:
         {
-            printf("%s,R%d,R%d,R%d ", stage->opcode_str, stage->rd, stage->rs1,
-                   stage->rs2);
+            fprintf(fp, "%s,R%d,R%d,R%d ", opcode_str, ins->rd,
+                    ins->rs1, ins->rs2);
             break;
         }
 
         case OPCODE_ADDL:
         case OPCODE_SUBL:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rd, stage->rs1, stage->imm);
+            fprintf(fp, "%s,R%d,R%d,#%d ", opcode_str, ins->rd, ins->rs1, ins->imm);
             break;
         }
 
         case OPCODE_NOP: 
         {
-            printf("%s ", stage->opcode_str);
+            fprintf(fp, "%s ", opcode_str);
             break;
         }
 
         case OPCODE_MOVC:
         {
-            printf("%s,R%d,#%d ", stage->opcode_str, stage->rd, stage->imm);
+            fprintf(fp, "%s,R%d,#%d ", opcode_str, ins->rd, ins->imm);
             break;
         }
 
         case OPCODE_LOAD:
         case OPCODE_LDI:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rd, stage->rs1,
-                   stage->imm);
+            fprintf(fp, "%s,R%d,R%d,#%d ", opcode_str, ins->rd, ins->rs1,
+                   ins->imm);
             break;
         }
 
         case OPCODE_STORE:
         case OPCODE_STI:
         {
-            printf("%s,R%d,R%d,#%d ", stage->opcode_str, stage->rs1, stage->rs2,
-                   stage->imm);
+            fprintf(fp, "%s,R%d,R%d,#%d ", opcode_str, ins->rs1, ins->rs2,
+                   ins->imm);
             break;
         }
 
@@ -86,39 +87,231 @@ print_instruction(const CPU_Stage *stage)
         case OPCODE_BP:
         case OPCODE_BNP:
         {
-            printf("%s,#%d ", stage->opcode_str, stage->imm);
+            fprintf(fp, "%s,#%d ", opcode_str, ins->imm);
             break;
         }
 
         case OPCODE_HALT:
         {
-            printf("%s", stage->opcode_str);
+            fprintf(fp, "%s", opcode_str);
             break;
         }
 
         case OPCODE_CMP:
         {
-            printf("%s,R%d,R%d ", stage->opcode_str, stage->rs1, stage->rs2);
+            fprintf(fp, "%s,R%d,R%d ", opcode_str, ins->rs1, ins->rs2);
             break;
         }
 
         case OPCODE_JUMP:
         {
-            printf("%s,R%d,R%d ", stage->opcode_str, stage->rs1, stage->imm);
+            fprintf(fp, "%s,R%d,R%d ", opcode_str, ins->rs1, ins->imm);
             break;
         }
     }
 }
 
+/* Mnemonic of an opcode, for instructions that do not come from code memory */
+static const char *
+opcode_name(int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_ADD: return "ADD";
+        case OPCODE_SUB: return "SUB";
+        case OPCODE_MUL: return "MUL";
+        case OPCODE_DIV: return "DIV";
+        case OPCODE_AND: return "AND";
+        case OPCODE_OR: return "OR";
+        case OPCODE_XOR: return "EXOR";
+        case OPCODE_MOVC: return "MOVC";
+        case OPCODE_LOAD: return "LOAD";
+        case OPCODE_STORE: return "STORE";
+        case OPCODE_ADDL: return "ADDL";
+        case OPCODE_SUBL: return "SUBL";
+        case OPCODE_LDI: return "LDI";
+        case OPCODE_STI: return "STI";
+        case OPCODE_CMP: return "CMP";
+        case OPCODE_NOP: return "NOP";
+        case OPCODE_JUMP: return "JUMP";
+        case OPCODE_BZ: return "BZ";
+        case OPCODE_BNZ: return "BNZ";
+        case OPCODE_HALT: return "HALT";
+        case OPCODE_BP: return "BP";
+        case OPCODE_BNP: return "BNP";
+    }
+
+    return "???";
+}
+
+/* Finds the instruction held in a latch, from code memory if there is one.
+ * Returns FALSE if there is nothing to print. */
+static int
+stage_instruction(const APEX_CPU *cpu, const CPU_Stage *stage,
+                  APEX_Instruction *ins, const char **opcode_str)
+{
+    int index = get_code_memory_index_from_pc(stage->pc);
+
+    if (!cpu->trace)
+    {
+        if (index < 0 || index >= cpu->code_memory_size)
+        {
+            return FALSE;
+        }
+        *ins = cpu->code_memory[index];
+        *opcode_str = cpu->program->opcode_str[index];
+        return TRUE;
+    }
+
+    ins->opcode = stage->opcode;
+    ins->rd = stage->rd;
+    ins->rs1 = stage->rs1;
+    ins->rs2 = stage->rs2;
+    ins->imm = stage->imm;
+    *opcode_str = opcode_name(stage->opcode);
+    return TRUE;
+}
+
+static void
+print_stage_instruction(FILE *fp, const APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    APEX_Instruction ins;
+    const char *opcode_str;
+
+    if (stage_instruction(cpu, stage, &ins, &opcode_str))
+    {
+        print_instruction(fp, &ins, opcode_str);
+    }
+}
+
+/* Formatters of the events logged with the asynchronous logger. They run on
+ * the logger thread and print exactly what the synchronous paths print. */
+static void
+format_text(FILE *fp, const APEX_Log_Event *event)
+{
+    fputs(event->str[0], fp);
+}
+
+static void
+format_cycle(FILE *fp, const APEX_Log_Event *event)
+{
+    fprintf(fp, "--------------------------------------------\n");
+    fprintf(fp, "Clock Cycle #: %d\n", event->arg[0]);
+    fprintf(fp, "--------------------------------------------\n");
+}
+
+static void
+format_stage(FILE *fp, const APEX_Log_Event *event)
+{
+    APEX_Instruction ins;
+
+    fprintf(fp, "%-15s: pc(%d) ", event->str[0], event->arg[0]);
+    if (event->str[1])
+    {
+        ins.opcode = event->arg[1];
+        ins.rd = event->arg[2];
+        ins.rs1 = event->arg[3];
+        ins.rs2 = event->arg[4];
+        ins.imm = event->arg[5];
+        print_instruction(fp, &ins, event->str[1]);
+    }
+    fprintf(fp, "\n");
+}
+
+/* Up to 8 registers from arg[0] on, then the line ending in str[0] */
+static void
+format_reg_row(FILE *fp, const APEX_Log_Event *event)
+{
+    int i;
+
+    for (i = 0; i < event->arg[1]; ++i)
+    {
+        fprintf(fp, "R%-3d[%-3d] ", event->arg[0] + i, event->arg[2 + i]);
+    }
+    fputs(event->str[0], fp);
+}
+
+static void
+format_arch_reg(FILE *fp, const APEX_Log_Event *event)
+{
+    fprintf(fp, "| \t REG[%d] \t | \t Value = %d \t | \t Status = %s \t \n",
+            event->arg[0], event->arg[1], event->str[0]);
+}
+
+static void
+format_data_word(FILE *fp, const APEX_Log_Event *event)
+{
+    fprintf(fp, "| \t MEM[%d] \t | \t Data Value = %d \t |\n", event->arg[0],
+            event->arg[1]);
+}
+
+static void
+log_text(const APEX_CPU *cpu, const char *text)
+{
+    APEX_Log_Event *event = APEX_log_reserve(cpu->log);
+
+    event->format = format_text;
+    event->str[0] = text;
+    APEX_log_commit(cpu->log);
+}
+
+/* Logs registers first..end-1 in rows of up to 8, ending the line after end */
+static void
+log_reg_rows(const APEX_CPU *cpu, int first, int end)
+{
+    APEX_Log_Event *event;
+    int i, j;
+
+    for (i = first; i < end; i += 8)
+    {
+        event = APEX_log_reserve(cpu->log);
+        event->format = format_reg_row;
+        event->arg[0] = i;
+        event->arg[1] = (end - i < 8) ? end - i : 8;
+        for (j = 0; j < event->arg[1]; ++j)
+        {
+            event->arg[2 + j] = cpu->regs[i + j];
+        }
+        event->str[0] = (i + 8 >= end) ? "\n" : "";
+        APEX_log_commit(cpu->log);
+    }
+}
+
 /* Debug function which prints the CPU stage content
  *
  * Note: You can edit this function to print in more detail
  */
 static void
-print_stage_content(const char *name, const CPU_Stage *stage)
+print_stage_content(const APEX_CPU *cpu, const char *name,
+                    const CPU_Stage *stage)
 {
+    APEX_Instruction ins;
+    APEX_Log_Event *event;
+
+    if (cpu->log)
+    {
+        event = APEX_log_reserve(cpu->log);
+        event->format = format_stage;
+        event->str[0] = name;
+        event->arg[0] = stage->pc;
+        if (stage_instruction(cpu, stage, &ins, &event->str[1]))
+        {
+            event->arg[1] = ins.opcode;
+            event->arg[2] = ins.rd;
+            event->arg[3] = ins.rs1;
+            event->arg[4] = ins.rs2;
+            event->arg[5] = ins.imm;
+        }
+        else
+        {
+            event->str[1] = NULL;
+        }
+        APEX_log_commit(cpu->log);
+        return;
+    }
+
     printf("%-15s: pc(%d) ", name, stage->pc);
-    print_instruction(stage);
+    print_stage_instruction(stdout, cpu, stage);
     printf("\n");
 }
 
@@ -131,16 +324,24 @@ print_reg_file(const APEX_CPU *cpu)
 {
     int i;
 
+    if (cpu->log)
+    {
+        log_text(cpu, "----------\nRegisters:\n----------\n");
+        log_reg_rows(cpu, 0, cpu->config.registers / 2);
+        log_reg_rows(cpu, cpu->config.registers / 2, cpu->config.registers);
+        return;
+    }
+
     printf("----------\n%s\n----------\n", "Registers:");
 
-    for (int i = 0; i < REG_FILE_SIZE / 2; ++i)
+    for (int i = 0; i < cpu->config.registers / 2; ++i)
     {
         printf("R%-3d[%-3d] ", i, cpu->regs[i]);
     }
 
     printf("\n");
 
-    for (i = (REG_FILE_SIZE / 2); i < REG_FILE_SIZE; ++i)
+    for (i = (cpu->config.registers / 2); i < cpu->config.registers; ++i)
     {
         printf("R%-3d[%-3d] ", i, cpu->regs[i]);
     }
@@ -150,12 +351,30 @@ print_reg_file(const APEX_CPU *cpu)
 
 int state_of_arch_reg_file(APEX_CPU* cpu) {
     int start = 0;
-    printf("\n==================================== STATE OF ARCHITECTURAL REGISTER FILE ====================================\n");
-    int total_number_of_registers = (int)(sizeof(cpu->regs)/4);
+    APEX_Log_Event *event;
+    static const char header[] = "\n==================================== STATE OF ARCHITECTURAL REGISTER FILE ====================================\n";
+    int total_number_of_registers = cpu->config.registers;
+
+    if (cpu->log)
+    {
+        log_text(cpu, header);
+        for (start = 0; start < total_number_of_registers; ++start)
+        {
+            event = APEX_log_reserve(cpu->log);
+            event->format = format_arch_reg;
+            event->arg[0] = start;
+            event->arg[1] = cpu->regs[start];
+            event->str[0] = (cpu->busy & REG_BIT(APEX_cpu_latches(cpu)->writeback.rd)) ? "INVALID" : "VALID";
+            APEX_log_commit(cpu->log);
+        }
+        return 0;
+    }
+
+    printf("%s", header);
 
     while(start < total_number_of_registers){
         int rd = 0;
-        printf("| \t REG[%d] \t | \t Value = %d \t | \t Status = %s \t \n", start, cpu->regs[start], (scoreBoard[cpu->writeback.rd]? "INVALID" : "VALID" ));
+        printf("| \t REG[%d] \t | \t Value = %d \t | \t Status = %s \t \n", start, cpu->regs[start], ((cpu->busy & REG_BIT(APEX_cpu_latches(cpu)->writeback.rd))? "INVALID" : "VALID" ));
         start++;
         rd++;
         
@@ -165,7 +384,24 @@ int state_of_arch_reg_file(APEX_CPU* cpu) {
 
 int state_of_data_memory(APEX_CPU* cpu) {
     int start = 0;
-    printf("\n========================================== STATE OF DATA MEMORY ================================================\n");
+    APEX_Log_Event *event;
+    static const char header[] = "\n========================================== STATE OF DATA MEMORY ================================================\n";
+
+    if (cpu->log)
+    {
+        log_text(cpu, header);
+        for (start = 0; start < 100; ++start)
+        {
+            event = APEX_log_reserve(cpu->log);
+            event->format = format_data_word;
+            event->arg[0] = start;
+            event->arg[1] = cpu->data_memory[start];
+            APEX_log_commit(cpu->log);
+        }
+        return 0;
+    }
+
+    printf("%s", header);
   
     while(start < 100){
         printf("| \t MEM[%d] \t | \t Data Value = %d \t |\n", start, cpu->data_memory[start]);
@@ -175,975 +411,2041 @@ int state_of_data_memory(APEX_CPU* cpu) {
 }
 
 /*
- * Fetch Stage of APEX Pipeline
- *
- * Note: You are free to edit this function according to your implementation
+ * Features the cycle functions test, as bits of a variant. Each variant is
+ * compiled with its bits as a constant, so what it leaves out costs no
+ * branches; APEX_cpu_step picks the variant for the cpu every cycle.
  */
+#define FEATURE_DEBUG 0x1      /* config.debug_messages */
+#define FEATURE_FORWARDING 0x2 /* config.forwarding */
+#define FEATURE_INSTRUMENT 0x4 /* Profiles, statistics, prediction or trace recording */
+#define FEATURE_TRACE 0x8      /* Trace-driven mode */
+#define FEATURE_SYSTEM 0x10    /* Core of a multi-core system */
+#define NUM_VARIANTS 0x20
+
+#define HAS(features, feature) (((features) & (feature)) != 0)
+
+/* Cycle functions are inlined into each variant for its bits to fold */
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+/* Copies the next trace record into a fetch latch */
 static void
-APEX_fetch(APEX_CPU *cpu)
+fetch_trace_record(APEX_CPU *cpu, CPU_Stage *stage)
 {
-    APEX_Instruction *current_ins;
-
-    if (cpu->fetch.has_insn)
-    {
-        /* This fetches new branch target instruction from next cycle */
-        if (cpu->fetch_from_next_cycle == TRUE)
-        {
-            cpu->fetch_from_next_cycle = FALSE;
+    const APEX_Trace_Record *rec = APEX_trace_get(cpu->trace, cpu->fetch_seq);
+
+    stage->pc = rec->pc;
+    stage->opcode = rec->opcode;
+    stage->rd = rec->rd;
+    stage->rs1 = rec->rs1;
+    stage->rs2 = rec->rs2;
+    stage->imm = rec->imm;
+    stage->seq = cpu->fetch_seq;
+}
 
-            /* Skip this cycle*/
-            return;
-        }
+static int
+is_memory_op(int opcode)
+{
+    return opcode == OPCODE_LOAD || opcode == OPCODE_STORE
+           || opcode == OPCODE_LDI || opcode == OPCODE_STI;
+}
 
-        /* Store current PC in fetch latch */
-        cpu->fetch.pc = cpu->pc;
-        /* Index into code memory using this pc and copy all instruction fields * into fetch latch  */
-        current_ins = &cpu->code_memory[get_code_memory_index_from_pc(cpu->pc)];
-        strcpy(cpu->fetch.opcode_str, current_ins->opcode_str);
-        cpu->fetch.opcode = current_ins->opcode;
-        cpu->fetch.rd = current_ins->rd;
-        cpu->fetch.rs1 = current_ins->rs1;
-        cpu->fetch.rs2 = current_ins->rs2;
-        cpu->fetch.imm = current_ins->imm;
-
-        /* Update PC for next instruction */
-        if(stall == FALSE){
-            cpu->pc += 4;
-            /* Copy data from fetch latch to decode latch*/
-            cpu->decode = cpu->fetch;
-        }else{
-            current_ins = &cpu->code_memory[get_code_memory_index_from_pc(cpu->pc)];
-            strcpy(cpu->fetch.opcode_str, current_ins->opcode_str);
-            cpu->fetch.opcode = current_ins->opcode;
-            cpu->fetch.rd = current_ins->rd;
-            cpu->fetch.rs1 = current_ins->rs1;
-            cpu->fetch.rs2 = current_ins->rs2;
-            cpu->fetch.imm = current_ins->imm;
-        }
-        
-        if (ENABLE_DEBUG_MESSAGES)
+/* Registers writeback writes for opcode */
+static int
+register_writes(int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_STORE:
+        case OPCODE_CMP:
+        case OPCODE_NOP:
+        case OPCODE_HALT:
+        case OPCODE_JUMP:
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        case OPCODE_BP:
+        case OPCODE_BNP:
         {
-            print_stage_content("Fetch", &cpu->fetch);
+            return 0;
         }
 
-        /* Stop fetching new instructions if HALT is fetched */
-        if (cpu->fetch.opcode == OPCODE_HALT && stall == FALSE)
+        case OPCODE_LDI:
         {
-            cpu->fetch.has_insn = FALSE;
+            return 2;
         }
     }
+
+    return 1;
 }
 
+/* Operands of an instruction, as bits of a Decode_Rule field */
+#define OPERAND_RD 0x1
+#define OPERAND_RS1 0x2
+#define OPERAND_RS2 0x4
+
 /*
- * Decode Stage of APEX Pipeline
- *
- * Note: You are free to edit this function according to your implementation
+ * How decode issues an opcode. With forwarding on, the instruction goes
+ * through the bypass once every operand in fwd_wait has a forwarded result,
+ * reading the operands in fwd_from from `collection`. Otherwise it goes
+ * through the register file once no operand in reg_wait is busy. Either way
+ * it reads the operands in reads, and marks the registers in the path's
+ * marks busy.
  */
-static void
-APEX_decode(APEX_CPU *cpu)
+typedef struct Decode_Rule
+{
+    uint8_t issues; /* FALSE if the opcode is held in decode */
+    uint8_t reads;
+    uint8_t fwd_wait;
+    uint8_t fwd_from;
+    uint8_t fwd_marks;
+    uint8_t reg_wait;
+    uint8_t reg_marks;
+} Decode_Rule;
+
+#define RULE_ALU                                                               \
+    {TRUE, OPERAND_RS1 | OPERAND_RS2, OPERAND_RS1 | OPERAND_RS2,               \
+     OPERAND_RS1 | OPERAND_RS2, OPERAND_RD, OPERAND_RS1 | OPERAND_RS2,         \
+     OPERAND_RD}
+#define RULE_ALU_LITERAL                                                       \
+    {TRUE, OPERAND_RS1, OPERAND_RS1, OPERAND_RS1, OPERAND_RD, OPERAND_RS1,     \
+     OPERAND_RD}
+#define RULE_CONTROL {TRUE, 0, 0, 0, 0, 0, 0}
+
+/*
+ * Indexed by opcode. The stores wait for rs1 on the bypass and for both
+ * operands on the register file. STI also takes rs2 from `collection` on the bypass, and marks
+ * it busy on the register file path for the write back of the incremented
+ * address; STORE writes no register and marks nothing. LDI marks its base
+ * register busy the same way.
+ */
+static const Decode_Rule decode_rules[NUM_OPCODES] = {
+    [OPCODE_ADD] = RULE_ALU,
+    [OPCODE_SUB] = RULE_ALU,
+    [OPCODE_MUL] = RULE_ALU,
+    [OPCODE_DIV] = RULE_ALU,
+    [OPCODE_AND] = RULE_ALU,
+    [OPCODE_OR] = RULE_ALU,
+    [OPCODE_XOR] = RULE_ALU,
+    [OPCODE_ADDL] = RULE_ALU_LITERAL,
+    [OPCODE_SUBL] = RULE_ALU_LITERAL,
+    [OPCODE_LOAD] = RULE_ALU_LITERAL,
+    [OPCODE_LDI] = {TRUE, OPERAND_RS1, OPERAND_RS1, OPERAND_RS1,
+                    OPERAND_RD | OPERAND_RS1, OPERAND_RS1,
+                    OPERAND_RD | OPERAND_RS1},
+    [OPCODE_STORE] = {TRUE, OPERAND_RS1 | OPERAND_RS2, OPERAND_RS1,
+                      OPERAND_RS1, 0, OPERAND_RS1 | OPERAND_RS2, 0},
+    [OPCODE_STI] = {TRUE, OPERAND_RS1 | OPERAND_RS2, OPERAND_RS1,
+                    OPERAND_RS1 | OPERAND_RS2, 0, OPERAND_RS1 | OPERAND_RS2,
+                    OPERAND_RS2},
+    [OPCODE_CMP] = {TRUE, OPERAND_RS1 | OPERAND_RS2, OPERAND_RS1 | OPERAND_RS2,
+                    OPERAND_RS1 | OPERAND_RS2, 0, OPERAND_RS1 | OPERAND_RS2,
+                    0},
+    [OPCODE_MOVC] = {TRUE, 0, 0, 0, OPERAND_RD, 0, OPERAND_RD},
+    [OPCODE_JUMP] = {TRUE, OPERAND_RS1, 0, 0, 0, 0, 0},
+    [OPCODE_HALT] = RULE_CONTROL,
+    [OPCODE_BZ] = RULE_CONTROL,
+    [OPCODE_BNZ] = RULE_CONTROL,
+    [OPCODE_BP] = RULE_CONTROL,
+    [OPCODE_BNP] = RULE_CONTROL,
+};
+
+/* Registers named by the operand bits of a Decode_Rule field, without
+ * branching on which operands the opcode has */
+static inline uint64_t
+operand_regs(const CPU_Stage *stage, int operands)
+{
+    return (REG_BIT(stage->rd) & -(uint64_t)(operands & 1))
+           | (REG_BIT(stage->rs1) & -(uint64_t)((operands >> 1) & 1))
+           | (REG_BIT(stage->rs2) & -(uint64_t)((operands >> 2) & 1));
+}
+
+/*
+ * Wires between the stages within a cycle. All of them run against the
+ * pipeline: memory holds execute, execute forwards to decode and redirects
+ * decode and fetch, and decode stalls fetch. They are worked out from the
+ * current latches once writeback has written the register file in the first
+ * half of the cycle, so no stage reads what another one writes.
+ */
+typedef struct CPU_Signals
+{
+    int memory_held;            /* Memory waits on the interconnect */
+    int execute_held;           /* Execute waits behind memory */
+    int redirect;               /* Execute resolved a taken branch */
+    int redirect_pc;
+    unsigned long redirect_seq; /* Trace record to fetch from, trace-driven mode */
+    uint64_t forward;           /* Register execute forwards a result to, or 0 */
+    int forward_reg;
+    int forward_value;
+    int issue;                  /* Decode moves its instruction to execute */
+    int from_collection;        /* Operands issue reads from `collection` */
+    uint64_t marks;             /* Registers issue marks busy */
+    int stall;                  /* Decode holds its instruction, fetch with it */
+    int alu;                    /* alu_result of execute, set by the caller */
+} CPU_Signals;
+
+/* Arithmetic wraps around at 32 bits, in unsigned so it is defined */
+static int alu_add(int a, int b) { return (int)((uint32_t)a + (uint32_t)b); }
+static int alu_sub(int a, int b) { return (int)((uint32_t)a - (uint32_t)b); }
+static int alu_mul(int a, int b) { return (int)((uint32_t)a * (uint32_t)b); }
+static int alu_div(int a, int b) { return a / b; }
+static int alu_and(int a, int b) { return a & b; }
+static int alu_or(int a, int b) { return a | b; }
+static int alu_xor(int a, int b) { return a ^ b; }
+static int alu_second(int a, int b) { (void)a; return b; }
+
+/* Operation of an ALU instruction or MOVC on rs1 and rs2, or the literal */
+typedef struct ALU_Op
+{
+    int (*compute)(int a, int b);
+    uint8_t literal;    /* b is imm rather than rs2 */
+    uint8_t sets_flags; /* The flags derive from the result */
+} ALU_Op;
+
+/* Indexed by opcode, compute is NULL for everything but the ALU */
+static const ALU_Op alu_ops[NUM_OPCODES] = {
+    [OPCODE_ADD] = {alu_add, FALSE, TRUE},
+    [OPCODE_SUB] = {alu_sub, FALSE, TRUE},
+    [OPCODE_MUL] = {alu_mul, FALSE, TRUE},
+    [OPCODE_DIV] = {alu_div, FALSE, TRUE},
+    [OPCODE_AND] = {alu_and, FALSE, FALSE},
+    [OPCODE_OR] = {alu_or, FALSE, FALSE},
+    [OPCODE_XOR] = {alu_xor, FALSE, FALSE},
+    [OPCODE_ADDL] = {alu_add, TRUE, TRUE},
+    [OPCODE_SUBL] = {alu_sub, TRUE, TRUE},
+    [OPCODE_MOVC] = {alu_second, TRUE, FALSE},
+};
+
+/* Result of an ALU instruction or MOVC, 0 for anything else */
+static int
+alu_result(const CPU_Stage *stage)
 {
-    if (cpu->decode.has_insn)
+    const ALU_Op *op = &alu_ops[stage->opcode];
+
+    if (!op->compute)
     {
-        /* Read operands from register file based on the instruction type */
-        switch (cpu->decode.opcode)
-        {
-            case OPCODE_ADD:
-            case OPCODE_SUB:
-            case OPCODE_MUL:
-            case OPCODE_DIV:
-            case OPCODE_AND:
-            case OPCODE_OR:
-            case OPCODE_XOR:
-            {
+        return 0;
+    }
 
-                if(collection[cpu->decode.rs1] != -1 && collection[cpu->decode.rs2] != -1){
-                    scoreBoard[cpu->decode.rd] = 1;
-                    cpu->decode.rs1_value = collection[cpu->decode.rs1];
-                    cpu->decode.rs2_value = collection[cpu->decode.rs2];
-                    cpu->execute = cpu->decode;
-                    cpu->decode.has_insn = FALSE;
-                    stall = FALSE;
-
-                }else if(scoreBoard[cpu->decode.rs1] == 0 && scoreBoard[cpu->decode.rs2] == 0){
-                    scoreBoard[cpu->decode.rd] = 1;
-
-                    cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                    cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-
-                    cpu->execute = cpu->decode;
-                    cpu->decode.has_insn = FALSE;
-                    stall = FALSE;
-                }else{
-                    cpu->decode.has_insn = TRUE;
-                    stall = TRUE;
-                }
-                
-                break;
-            }
+    return op->compute(stage->rs1_value,
+                       op->literal ? stage->imm : stage->rs2_value);
+}
 
-            case OPCODE_ADDL:
-            case OPCODE_SUBL:
-            {
-                if(collection[cpu->decode.rs1] != -1){
-                    scoreBoard[cpu->decode.rd] = 1;
-                    cpu->decode.rs1_value = collection[cpu->decode.rs1];
-                    cpu->execute = cpu->decode;
-                    cpu->decode.has_insn = FALSE;
-                    stall = FALSE;
-
-                }else if(scoreBoard[cpu->decode.rs1] == 0){
-                    scoreBoard[cpu->decode.rd] = 1;
-                    cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                    cpu->execute = cpu->decode;
-                    cpu->decode.has_insn = FALSE;
-                    stall = FALSE;
-                }else{
-                    cpu->decode.has_insn = TRUE;
-                    stall = TRUE;
-                }
-                break;
-            }
+/* Result the instruction in execute forwards to decode, if any */
+static ALWAYS_INLINE void
+execute_forward(const APEX_CPU *cpu, const CPU_Stage *stage, CPU_Signals *sig,
+                int features)
+{
+    if (alu_ops[stage->opcode].compute)
+    {
+        sig->forward_reg = stage->rd;
+        sig->forward_value
+            = HAS(features, FEATURE_TRACE)
+                  ? APEX_trace_get(cpu->trace, stage->seq)->result
+                  : sig->alu;
+        sig->forward = REG_BIT(sig->forward_reg);
+        return;
+    }
 
-            case OPCODE_LOAD:
-            {
-                if(collection[cpu->decode.rs1] != -1){
-                    scoreBoard[cpu->decode.rd] = 1;
-                    cpu->decode.rs1_value = collection[cpu->decode.rs1];
-                    cpu->execute = cpu->decode;
-                    cpu->decode.has_insn = FALSE;
-                    stall = FALSE;
-                }else if(scoreBoard[cpu->decode.rs1] == 0){
-                    scoreBoard[cpu->decode.rd] = 1;
-                    cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                    cpu->execute = cpu->decode;
-                    cpu->decode.has_insn = FALSE;
-                    stall = FALSE;
-                }else{
-                    cpu->decode.has_insn = TRUE;
-                    stall = TRUE;
-                }
-                break;
-            }
+    switch (stage->opcode)
+    {
+        case OPCODE_LDI:
+        {
+            sig->forward_reg = stage->rd;
+            sig->forward_value = stage->rs1_value + 4;
+            break;
+        }
 
-            case OPCODE_LDI:
-            {
-                if(collection[cpu->decode.rs1] != -1){
-                    scoreBoard[cpu->decode.rd] = 1;
-                    scoreBoard[cpu->decode.rs1] = 1;
-                    
-                    cpu->decode.rs1_value = collection[cpu->decode.rs1];
-                    cpu->execute = cpu->decode;
-                    cpu->decode.has_insn = FALSE;
-                    stall = FALSE;
-
-                }else if(scoreBoard[cpu->decode.rs1] == 0){
-                    scoreBoard[cpu->decode.rd] = 1;
-                    scoreBoard[cpu->decode.rs1] = 1;
-                    cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                    cpu->execute = cpu->decode;
-                    cpu->decode.has_insn = FALSE;
-                    stall = FALSE;
-                }else{
-                    cpu->decode.has_insn = TRUE;
-                    stall = TRUE;
-                }
-                break;
-            }
+        case OPCODE_STI:
+        {
+            sig->forward_reg = stage->rs2;
+            sig->forward_value = stage->rs2_value + 4;
+            break;
+        }
 
-            case OPCODE_STI:
-            {
-                if(collection[cpu->decode.rs1] != -1){
-                    cpu->decode.rs1_value = collection[cpu->decode.rs1];
-                    cpu->decode.rs2_value = collection[cpu->decode.rs2];
-                    cpu->execute = cpu->decode;
-                    cpu->decode.has_insn = FALSE;
-                    stall = FALSE;
-                    
-                }else if(scoreBoard[cpu->decode.rs2] == 0){
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                scoreBoard[cpu->decode.rs2] = 1;
-                cpu->execute = cpu->decode;
-                cpu->decode.has_insn = FALSE;
-                stall = FALSE;
-                }else{
-                    cpu->decode.has_insn = TRUE;
-                    stall = TRUE;
-                }
-                break;
-            }
+        default:
+        {
+            return;
+        }
+    }
 
-           /* case OPCODE_STORE:
-            {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                cpu->execute = cpu->decode;
-                cpu->decode.has_insn = FALSE;
-                stall = FALSE;
-                break;
-            }*/
+    sig->forward = REG_BIT(sig->forward_reg);
+}
 
-            case OPCODE_STORE:
-            {
-                if(collection[cpu->decode.rs1] != -1){
-                    cpu->decode.rs1_value = collection[cpu->decode.rs1];
-                    cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                    cpu->execute = cpu->decode;
-                    cpu->decode.has_insn = FALSE;
-                    stall = FALSE;
-                    
-                }else if(scoreBoard[cpu->decode.rs2] == 0){
-                    cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                    cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-                    scoreBoard[cpu->decode.rs2] = 1;
-                    cpu->execute = cpu->decode;
-                    cpu->decode.has_insn = FALSE;
-                    stall = FALSE;
-                }else{
-                    cpu->decode.has_insn = TRUE;
-                    stall = TRUE;
-                }
-                break;
-            }
+/* Whether the branch in execute is taken, and where fetch goes from there */
+static ALWAYS_INLINE void
+execute_redirect(const APEX_CPU *cpu, const CPU_Stage *stage,
+                 CPU_Signals *sig, int features)
+{
+    switch (stage->opcode)
+    {
+        case OPCODE_JUMP: sig->redirect = TRUE; break;
+        case OPCODE_BZ: sig->redirect = APEX_cpu_zero_flag(cpu); break;
+        case OPCODE_BNZ: sig->redirect = !APEX_cpu_zero_flag(cpu); break;
+        case OPCODE_BP: sig->redirect = APEX_cpu_positive_flag(cpu); break;
+        case OPCODE_BNP: sig->redirect = !APEX_cpu_positive_flag(cpu); break;
+        default: return;
+    }
 
+    if (HAS(features, FEATURE_TRACE))
+    {
+        /* Refetch from the record after the branch, the ones fetched
+         * behind it are squashed like a wrong path */
+        sig->redirect = (APEX_trace_get(cpu->trace, stage->seq)->flags
+                         & APEX_TRACE_TAKEN) != 0;
+        sig->redirect_seq = stage->seq + 1;
+        sig->redirect_pc
+            = APEX_trace_get(cpu->trace, sig->redirect_seq)->pc;
+    }
+    else if (stage->opcode == OPCODE_JUMP)
+    {
+        sig->redirect_pc = stage->rs1_value + stage->imm;
+    }
+    else
+    {
+        sig->redirect_pc = stage->pc + stage->imm;
+    }
+}
 
-            case OPCODE_MOVC:
-            {
-                scoreBoard[cpu->decode.rd] = 1;
-                cpu->execute = cpu->decode;
-                cpu->decode.has_insn = FALSE;
-                stall = FALSE;
-                /* MOVC doesn't have register operands */
-                break;
-            }
+/* What `collection` held for a register nothing was forwarded to */
+#define NO_RESULT -1
 
-            case OPCODE_CMP:
-            {
-                if(collection[cpu->decode.rs1] != -1 && collection[cpu->decode.rs2] != -1){
-                    cpu->decode.rs1_value = collection[cpu->decode.rs1];
-                    cpu->decode.rs2_value = collection[cpu->decode.rs2];
-
-                    cpu->execute = cpu->decode;
-                    cpu->decode.has_insn = FALSE;
-                    stall = FALSE;
-                }else if(scoreBoard[cpu->decode.rs1] == 0 && scoreBoard[cpu->decode.rs2] == 0){
-
-                    cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
-                    cpu->decode.rs2_value = cpu->regs[cpu->decode.rs2];
-
-                    cpu->execute = cpu->decode;
-                    cpu->decode.has_insn = FALSE;
-                    stall = FALSE;
-                }else{
-                    cpu->decode.has_insn = TRUE;
-                    stall = TRUE;
-                }
-                
-                break;
-            }
+/*
+ * Registers with a usable result in `collection` once the forward of the
+ * cycle lands. A forwarded result of -1 reads as "no result", as it always
+ * has, so it withdraws the register from the bypass until writeback.
+ */
+static inline uint64_t
+forwarded_after(const APEX_CPU *cpu, const CPU_Signals *sig)
+{
+    if (sig->forward_value == NO_RESULT)
+    {
+        return cpu->forwarded & ~sig->forward;
+    }
 
-            case OPCODE_JUMP:
-            {
-                cpu->decode.rs1_value = cpu->regs[cpu->decode.rs1];
+    return cpu->forwarded | sig->forward;
+}
 
-                cpu->execute = cpu->decode;
-                cpu->decode.has_insn = FALSE;
-                stall = FALSE;
-                break;
-            }
+/*
+ * Works out the signals of the cycle from the current latches, from the back
+ * of the pipeline to the front since each depends on those behind it
+ */
+static ALWAYS_INLINE void
+resolve_signals(const APEX_CPU *cpu, CPU_Signals *sig, int features)
+{
+    const CPU_Latches *latch = APEX_cpu_latches(cpu);
+    const CPU_Stage *stage;
+    const Decode_Rule *rule;
+    uint64_t fwd_wait;
+    int bypass;
+
+    /* Memory holds while the interconnect has not completed its access */
+    stage = &latch->memory;
+    sig->memory_held = stage->has_insn && HAS(features, FEATURE_SYSTEM)
+                       && is_memory_op(stage->opcode)
+                       && !APEX_system_ready(cpu->system, cpu->core_id, stage,
+                                             cpu->clock);
+    sig->execute_held = latch->execute.has_insn && sig->memory_held;
+
+    sig->forward = 0;
+    sig->redirect = FALSE;
+    if (latch->execute.has_insn && !sig->execute_held)
+    {
+        execute_forward(cpu, &latch->execute, sig, features);
+        execute_redirect(cpu, &latch->execute, sig, features);
+    }
 
-            case OPCODE_HALT:
-            {
-                cpu->execute = cpu->decode;
-                cpu->decode.has_insn = FALSE;
-                stall = FALSE;
-                break;
-            }
+    /* Retiring an instruction ends a stall decode has no instruction for */
+    sig->stall = latch->writeback.has_insn ? FALSE : cpu->stall;
+    sig->issue = FALSE;
+    sig->marks = 0;
 
-            case OPCODE_BP:
-            case OPCODE_BNP:
-            case OPCODE_BZ:
-            case OPCODE_BNZ:
-            {
-                cpu->execute = cpu->decode;
-                cpu->decode.has_insn = FALSE;
-                stall = FALSE;
-                break;
-            }
+    /* A taken branch squashes the instruction in decode */
+    stage = &latch->decode;
+    if (!stage->has_insn || sig->redirect)
+    {
+        return;
+    }
 
-            case OPCODE_NOP:
-            {
-                break;
-            }
-        }
+    /* Readiness of all the sources is one AND against each bitset, with
+     * the result execute forwards in this cycle */
+    rule = &decode_rules[stage->opcode];
+    fwd_wait = operand_regs(stage, rule->fwd_wait);
+    bypass = HAS(features, FEATURE_FORWARDING)
+             && (forwarded_after(cpu, sig) & fwd_wait) == fwd_wait;
+
+    if (!rule->issues)
+    {
+        /* NOP is held in decode */
+    }
+    else if (sig->execute_held)
+    {
+        /* Execute is held behind the memory stage */
+        sig->stall = TRUE;
+    }
+    else if (bypass
+             || !(cpu->busy & operand_regs(stage, rule->reg_wait)))
+    {
+        sig->issue = TRUE;
+        sig->stall = FALSE;
+        sig->from_collection = bypass ? rule->fwd_from : 0;
+        sig->marks = operand_regs(stage, bypass ? rule->fwd_marks
+                                                : rule->reg_marks);
+    }
+    else
+    {
+        sig->stall = TRUE;
+    }
+}
 
-        if (ENABLE_DEBUG_MESSAGES)
+/* Value of reg in the register file, or in `collection` with the result
+ * execute forwards in this cycle */
+static inline int
+operand_value(const APEX_CPU *cpu, const CPU_Signals *sig, int reg,
+              int from_collection)
+{
+    if (from_collection)
+    {
+        /* STI takes rs2 through the bypass without waiting for it, and
+         * gets "no result" if nothing has been forwarded to it yet */
+        if (!(forwarded_after(cpu, sig) & REG_BIT(reg)))
         {
-            print_stage_content("Decode/RF", &cpu->decode);
+            return NO_RESULT;
         }
+
+        return (sig->forward & REG_BIT(reg)) ? sig->forward_value
+                                             : cpu->collection[reg];
     }
+
+    return cpu->regs[reg];
 }
 
 /*
- * Execute Stage of APEX Pipeline
+ * Clock edge: makes the busy bits and forwarded result of the cycle visible
+ * and swaps the next latches in
+ */
+static void
+commit_cycle(APEX_CPU *cpu, const CPU_Signals *sig)
+{
+    cpu->busy |= sig->marks;
+
+    if (sig->forward)
+    {
+        cpu->collection[sig->forward_reg] = sig->forward_value;
+        cpu->forwarded = forwarded_after(cpu, sig);
+    }
+
+    cpu->cur = !cpu->cur;
+}
+
+/*
+ * Fetch Stage of APEX Pipeline
  *
  * Note: You are free to edit this function according to your implementation
  */
+static ALWAYS_INLINE void
+APEX_fetch(APEX_CPU *cpu, const CPU_Signals *sig, int features)
+{
+    const CPU_Latches *latch = APEX_cpu_latches(cpu);
+    CPU_Latches *next = &cpu->latches[!cpu->cur];
+    const CPU_Stage *stage = &latch->fetch;
+    CPU_Stage *out = &next->fetch;
+    const APEX_Instruction *current_ins;
+    int i, new_insn;
+
+    *out = *stage;
+
+    /* A taken branch flushes decode, the target is fetched from the next
+     * cycle on */
+    if (sig->redirect)
+    {
+        cpu->pc = sig->redirect_pc;
+        if (HAS(features, FEATURE_TRACE))
+        {
+            cpu->fetch_seq = sig->redirect_seq;
+        }
+        out->has_insn = TRUE;
+        next->decode.has_insn = FALSE;
+        return;
+    }
+
+    if (!stage->has_insn)
+    {
+        /* Nothing follows the instruction decode issues */
+        next->decode = latch->decode;
+        if (sig->issue)
+        {
+            next->decode.has_insn = FALSE;
+        }
+        return;
+    }
+
+    /* A stalled fetch holds on to its instruction unless redirected */
+    new_insn = !cpu->fetch_held || stage->pc != cpu->pc;
+
+    if (HAS(features, FEATURE_TRACE))
+    {
+        fetch_trace_record(cpu, out);
+    }
+    else
+    {
+        /* Store current PC in fetch latch */
+        out->pc = cpu->pc;
+        /* Index into code memory using this pc and copy all instruction fields * into fetch latch  */
+        current_ins = &cpu->code_memory[get_code_memory_index_from_pc(cpu->pc)];
+        out->opcode = current_ins->opcode;
+        out->rd = current_ins->rd;
+        out->rs1 = current_ins->rs1;
+        out->rs2 = current_ins->rs2;
+        out->imm = current_ins->imm;
+    }
+
+    if (new_insn)
+    {
+        if (HAS(features, FEATURE_INSTRUMENT) && cpu->energy)
+        {
+            cpu->energy->events[ENERGY_FETCH]++;
+        }
+        out->enter_cycle[STAGE_FETCH] = cpu->clock;
+        for (i = STAGE_DECODE; i < NUM_STAGES; ++i)
+        {
+            out->enter_cycle[i] = -1;
+        }
+    }
+    cpu->fetch_held = sig->stall;
+
+    /* Update PC for next instruction */
+    if (sig->stall == FALSE)
+    {
+        if (HAS(features, FEATURE_TRACE))
+        {
+            cpu->fetch_seq++;
+            cpu->pc = APEX_trace_get(cpu->trace, cpu->fetch_seq)->pc;
+        }
+        else
+        {
+            cpu->pc += 4;
+        }
+        /* Copy data from fetch latch to decode latch*/
+        next->decode = *out;
+        next->decode.enter_cycle[STAGE_DECODE] = cpu->clock + 1;
+    }
+    else
+    {
+        next->decode = latch->decode;
+    }
+
+    if (HAS(features, FEATURE_DEBUG))
+    {
+        print_stage_content(cpu, "Fetch", out);
+    }
+
+    /* Stop fetching new instructions if HALT is fetched */
+    if (out->opcode == OPCODE_HALT && sig->stall == FALSE)
+    {
+        out->has_insn = FALSE;
+    }
+}
+
+/* Looks up the result of the instruction decode issues to execute, see
+ * APEX_Value_Predictor */
 static void
-APEX_execute(APEX_CPU *cpu)
+predict_result(APEX_CPU *cpu)
+{
+    CPU_Stage *out = &cpu->latches[!cpu->cur].execute;
+
+    out->has_prediction
+        = register_writes(out->opcode)
+          && APEX_predictor_lookup(cpu->predictor, out->pc, &out->predicted);
+    cpu->predictor->predictions += out->has_prediction;
+}
+
+/* Whether the instruction that writes back reg next, which has left decode
+ * but not yet reached writeback, carries a prediction for it */
+static int
+writer_predicted(const APEX_CPU *cpu, int reg)
 {
-    if (cpu->execute.has_insn)
+    const CPU_Latches *latch = APEX_cpu_latches(cpu);
+    const CPU_Stage *writers[2] = {&latch->memory, &latch->execute};
+    const CPU_Stage *stage;
+    int i;
+
+    for (i = 0; i < 2; ++i)
     {
-        /* Execute logic based on instruction type */
-        switch (cpu->execute.opcode)
+        stage = writers[i];
+        if (!stage->has_insn)
         {
-            case OPCODE_ADD:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value + cpu->execute.rs2_value;
-                
-                collection[cpu->execute.rd] = cpu->execute.result_buffer;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                }
-
-                if (cpu->execute.result_buffer > 0)
-                {
-                    cpu->positive_flag = TRUE;
-                }
-                else{
-                    cpu->positive_flag = FALSE;
-                }
-                break;
-            }
+            continue;
+        }
+        /* Only the loaded value of LDI is predicted, not the new base */
+        if (stage->opcode == OPCODE_LDI && stage->rs1 == reg)
+        {
+            return FALSE;
+        }
+        if (register_writes(stage->opcode) && stage->rd == reg)
+        {
+            return stage->has_prediction;
+        }
+    }
 
-            case OPCODE_ADDL:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value + cpu->execute.imm;
-                
-                collection[cpu->execute.rd] = cpu->execute.result_buffer;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                }
-
-                if (cpu->execute.result_buffer > 0)
-                {
-                    cpu->positive_flag = TRUE;
-                }
-                else{
-                    cpu->positive_flag = FALSE;
-                }
-                break;
-            }
+    return FALSE;
+}
 
-              case OPCODE_SUBL:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value - cpu->execute.imm;
-
-                collection[cpu->execute.rd] = cpu->execute.result_buffer;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                }
-
-                if (cpu->execute.result_buffer > 0)
-                {
-                    cpu->positive_flag = TRUE;
-                }
-                else{
-                    cpu->positive_flag = FALSE;
-                }
-                break;
-            }
+/* Charges a decode stall cycle to the busy registers it waits on */
+static void
+charge_stall(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    APEX_Value_Predictor *pred = cpu->predictor;
+    uint64_t waits = cpu->busy
+                     & operand_regs(stage, decode_rules[stage->opcode].reg_wait);
+    uint64_t left;
 
-            case OPCODE_SUB:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value - cpu->execute.rs2_value;
-                
-                collection[cpu->execute.rd] = cpu->execute.result_buffer;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                }
-
-                if (cpu->execute.result_buffer > 0)
-                {
-                    cpu->positive_flag = TRUE;
-                }
-                else{
-                    cpu->positive_flag = FALSE;
-                }
-                break;
-            }
+    /* Stalls behind a held execute do not wait on registers */
+    if (!waits)
+    {
+        return;
+    }
 
-            case OPCODE_MUL:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value * cpu->execute.rs2_value;
-
-                collection[cpu->execute.rd] = cpu->execute.result_buffer;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                }
-
-                if (cpu->execute.result_buffer > 0)
-                {
-                    cpu->positive_flag = TRUE;
-                }
-                else{
-                    cpu->positive_flag = FALSE;
-                }
-                break;
-            }
+    for (left = waits; left; left &= left - 1)
+    {
+        if (!writer_predicted(cpu, __builtin_ctzll(left)))
+        {
+            pred->stalls_kept++;
+            return;
+        }
+    }
 
-            case OPCODE_DIV:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value / cpu->execute.rs2_value;
-
-                collection[cpu->execute.rd] = cpu->execute.result_buffer;
-
-                /* Set the zero flag based on the result buffer */
-                if (cpu->execute.result_buffer == 0)
-                {
-                    cpu->zero_flag = TRUE;
-                } 
-                else 
-                {
-                    cpu->zero_flag = FALSE;
-                }
-
-                if (cpu->execute.result_buffer > 0)
-                {
-                    cpu->positive_flag = TRUE;
-                }
-                else{
-                    cpu->positive_flag = FALSE;
-                }
-                break;
-            }
+    pred->waiting[__builtin_ctzll(waits)]++;
+}
 
-             case OPCODE_AND:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value & cpu->execute.rs2_value;
-                collection[cpu->execute.rd] = cpu->execute.result_buffer;
-                    break;
-            }
+/* Verifies the prediction of a retiring instruction, settling the stalls
+ * charged to the register it writes, and trains the predictor */
+static void
+verify_prediction(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    APEX_Value_Predictor *pred = cpu->predictor;
 
-             case OPCODE_OR:
-            {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value | cpu->execute.rs2_value;
-                collection[cpu->execute.rd] = cpu->execute.result_buffer;
-                    break;
-            }
+    if (stage->has_prediction && stage->predicted == stage->result_buffer)
+    {
+        pred->correct++;
+        pred->stalls_removed += pred->waiting[stage->rd];
+    }
+    else
+    {
+        pred->stalls_kept += pred->waiting[stage->rd];
+    }
+
+    pred->waiting[stage->rd] = 0;
+    APEX_predictor_train(pred, stage->pc, stage->result_buffer);
+}
+
+/* Reads the operands and moves decode into execute */
+static void
+issue(APEX_CPU *cpu, const CPU_Signals *sig)
+{
+    const CPU_Stage *stage = &APEX_cpu_latches(cpu)->decode;
+    CPU_Stage *out = &cpu->latches[!cpu->cur].execute;
+    int reads = decode_rules[stage->opcode].reads;
+    int rs1_value = operand_value(cpu, sig, stage->rs1,
+                                  sig->from_collection & OPERAND_RS1);
+    int rs2_value = operand_value(cpu, sig, stage->rs2,
+                                  sig->from_collection & OPERAND_RS2);
+
+    *out = *stage;
+
+    /* Operands the opcode does not read keep their value, selected rather
+     * than branched on so the opcode mix does not train the host predictor */
+    out->rs1_value = (reads & OPERAND_RS1) ? rs1_value : out->rs1_value;
+    out->rs2_value = (reads & OPERAND_RS2) ? rs2_value : out->rs2_value;
+    out->enter_cycle[STAGE_EXECUTE] = cpu->clock + 1;
+}
+
+/*
+ * Decode Stage of APEX Pipeline
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+static ALWAYS_INLINE void
+APEX_decode(APEX_CPU *cpu, const CPU_Signals *sig, int features)
+{
+    const CPU_Latches *latch = APEX_cpu_latches(cpu);
+    const CPU_Stage *stage = &latch->decode;
+    CPU_Stage *out = &cpu->latches[!cpu->cur].execute;
+
+    if (sig->issue)
+    {
+        issue(cpu, sig);
+        if (HAS(features, FEATURE_INSTRUMENT) && cpu->energy)
+        {
+            /* Operands from `collection` do not read the register file */
+            cpu->energy->events[ENERGY_REG_READ] += __builtin_popcount(
+                decode_rules[stage->opcode].reads & ~sig->from_collection);
+        }
+        if (HAS(features, FEATURE_INSTRUMENT) && cpu->predictor)
+        {
+            predict_result(cpu);
+        }
+    }
+    else if (sig->execute_held)
+    {
+        *out = latch->execute;
+    }
+    else
+    {
+        out->has_insn = FALSE;
+    }
+    cpu->stall = sig->stall;
 
-             case OPCODE_XOR:
+    if (stage->has_insn && !sig->redirect)
+    {
+        /* Charge the stalled cycle to the instruction waiting in decode */
+        if (sig->stall == TRUE)
+        {
+            cpu->stall_cycles++;
+            if (HAS(features, FEATURE_INSTRUMENT) && cpu->profile)
             {
-                cpu->execute.result_buffer
-                    = cpu->execute.rs1_value ^ cpu->execute.rs2_value;
-                collection[cpu->execute.rd] = cpu->execute.result_buffer;
-                    break;
+                cpu->profile[get_code_memory_index_from_pc(stage->pc)]
+                    .stall_cycles++;
             }
-            
-            case OPCODE_LOAD:
+            if (HAS(features, FEATURE_INSTRUMENT) && cpu->predictor)
             {
-                cpu->execute.memory_address
-                    = cpu->execute.rs1_value + cpu->execute.imm;
-                break;
+                charge_stall(cpu, stage);
             }
+        }
 
-            case OPCODE_STORE:           
-            {
-                cpu->execute.memory_address
-                    = cpu->execute.rs2_value + cpu->execute.imm;
-                
-                //collection[cpu->execute.rd] = cpu->execute.new_result_buffer;
-                break;
-            }
+        if (HAS(features, FEATURE_DEBUG))
+        {
+            print_stage_content(cpu, "Decode/RF", stage);
+        }
+    }
+}
 
-            case OPCODE_JUMP:   
-            {
-                cpu->pc = cpu->execute.rs1_value + cpu->execute.imm;
-                /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
+/* Flags of CMP: equal clears P and sets Z, greater the other way round,
+ * less leaves both alone */
+static inline void
+compare_flags(APEX_CPU *cpu, int a, int b)
+{
+    if (a == b)
+    {
+        cpu->flags = 0;
+    }
+    else if (a > b)
+    {
+        cpu->flags = 1;
+    }
+}
 
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
+/*
+ * Execute stage of trace-driven mode. Results, addresses and branch outcomes
+ * come from the trace record; the forwarding and redirect the timing depends
+ * on are part of the signals. The flags follow the recorded results, so that
+ * they end up as in the recorded run, though the branches do not use them.
+ */
+static void
+replay_execute(APEX_CPU *cpu, CPU_Stage *stage)
+{
+    const APEX_Trace_Record *rec = APEX_trace_get(cpu->trace, stage->seq);
 
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                break;
-            }
+    stage->memory_address = rec->memory_address;
 
-            case OPCODE_LDI:
-            {
-                cpu->execute.memory_address
-                    = cpu->execute.rs1_value + cpu->execute.imm;
-                
-                cpu->execute.new_result_buffer
-                    = cpu->execute.rs1_value + 4;
-                
-                collection[cpu->execute.rd] = cpu->execute.new_result_buffer;
-                break;
-            }
+    if (alu_ops[stage->opcode].sets_flags)
+    {
+        cpu->flags = rec->result;
+    }
+    else if (stage->opcode == OPCODE_CMP)
+    {
+        compare_flags(cpu, stage->rs1_value, stage->rs2_value);
+    }
 
-            case OPCODE_STI:           
-            {
-                cpu->execute.memory_address
-                    = cpu->execute.rs2_value + cpu->execute.imm;
+    switch (stage->opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_MOVC:
+        case OPCODE_LOAD:
+        {
+            stage->result_buffer = rec->result;
+            break;
+        }
 
-                cpu->execute.new_result_buffer
-                    = cpu->execute.rs2_value + 4;
-                
-                collection[cpu->execute.rs2] = cpu->execute.new_result_buffer;
-                break;
-            }
+        case OPCODE_LDI:
+        {
+            stage->result_buffer = rec->result;
+            stage->new_result_buffer = stage->rs1_value + 4;
+            break;
+        }
 
-            case OPCODE_CMP:
+        case OPCODE_STI:
+        {
+            stage->new_result_buffer = stage->rs2_value + 4;
+            break;
+        }
+    }
+}
+
+/*
+ * Execute Stage of APEX Pipeline
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+static ALWAYS_INLINE void
+APEX_execute(APEX_CPU *cpu, const CPU_Signals *sig, int features)
+{
+    const CPU_Latches *latch = APEX_cpu_latches(cpu);
+    const CPU_Stage *stage = &latch->execute;
+    CPU_Stage *out = &cpu->latches[!cpu->cur].memory;
+
+    if (!stage->has_insn || sig->execute_held)
+    {
+        /* Memory keeps its instruction while it is held */
+        if (sig->memory_held)
+        {
+            *out = latch->memory;
+        }
+        else
+        {
+            out->has_insn = FALSE;
+        }
+
+        /* Held while memory waits on the interconnect */
+        if (stage->has_insn && HAS(features, FEATURE_DEBUG))
+        {
+            print_stage_content(cpu, "Execute", stage);
+        }
+        return;
+    }
+
+    /* Copy data from execute latch to memory latch*/
+    *out = *stage;
+
+    if (HAS(features, FEATURE_INSTRUMENT) && cpu->energy)
+    {
+        APEX_energy_execute(cpu->energy, out->opcode);
+    }
+
+    if (HAS(features, FEATURE_TRACE))
+    {
+        replay_execute(cpu, out);
+    }
+    else
+    {
+        /* ALU results are the ones worked out for forwarding, see
+         * execute_forward. The flags are only derived when a branch needs
+         * them, from the last result that sets them. */
+        if (alu_ops[out->opcode].compute)
+        {
+            out->result_buffer = sig->alu;
+            if (alu_ops[out->opcode].sets_flags)
             {
-                if(cpu->execute.rs1_value == cpu->execute.rs2_value){
-                    cpu->zero_flag = TRUE;
-                    cpu->positive_flag = FALSE;
-                }
-                
-                if(cpu->execute.rs1_value > cpu->execute.rs2_value){
-                    cpu->positive_flag = TRUE;
-                    cpu->zero_flag = FALSE;
-                }
-                break;
+                cpu->flags = sig->alu;
             }
+        }
 
-            case OPCODE_NOP:
+        /* Execute logic based on instruction type */
+        switch (out->opcode)
+        {
+            case OPCODE_LOAD:
             {
+                out->memory_address = out->rs1_value + out->imm;
                 break;
             }
 
-            case OPCODE_BZ:
+            case OPCODE_STORE:
             {
-                if (cpu->zero_flag == TRUE)
-                {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
+                out->memory_address = out->rs2_value + out->imm;
                 break;
             }
 
-            case OPCODE_BP:
+            case OPCODE_LDI:
             {
-                if (cpu->positive_flag == TRUE)
-                {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
+                out->memory_address = out->rs1_value + out->imm;
+                out->new_result_buffer = out->rs1_value + 4;
                 break;
             }
 
-            case OPCODE_BNP:
+            case OPCODE_STI:
             {
-                if (cpu->positive_flag == FALSE)
-                {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
+                out->memory_address = out->rs2_value + out->imm;
+                out->new_result_buffer = out->rs2_value + 4;
                 break;
             }
 
-            case OPCODE_BNZ:
+            case OPCODE_CMP:
             {
-                if (cpu->zero_flag == FALSE)
-                {
-                    /* Calculate new PC, and send it to fetch unit */
-                    cpu->pc = cpu->execute.pc + cpu->execute.imm;
-                    
-                    /* Since we are using reverse callbacks for pipeline stages, 
-                     * this will prevent the new instruction from being fetched in the current cycle*/
-                    cpu->fetch_from_next_cycle = TRUE;
-
-                    /* Flush previous stages */
-                    cpu->decode.has_insn = FALSE;
-
-                    /* Make sure fetch stage is enabled to start fetching from new PC */
-                    cpu->fetch.has_insn = TRUE;
-                }
+                compare_flags(cpu, out->rs1_value, out->rs2_value);
                 break;
             }
 
-            case OPCODE_MOVC: 
-            {
-                cpu->execute.result_buffer = cpu->execute.imm;
-                collection[cpu->execute.rd] = cpu->execute.result_buffer;
-                break;
-            }
+            /* The branches only redirect fetch, see execute_redirect */
+        }
+
+        if (HAS(features, FEATURE_INSTRUMENT) && cpu->values
+            && is_memory_op(out->opcode))
+        {
+            APEX_value_sample(
+                &cpu->values[get_code_memory_index_from_pc(out->pc)].address,
+                out->memory_address);
+        }
+    }
+
+    out->branch_taken = sig->redirect;
+    out->enter_cycle[STAGE_MEMORY] = cpu->clock + 1;
+    if (sig->redirect)
+    {
+        cpu->flushes++;
+        if (HAS(features, FEATURE_INSTRUMENT) && cpu->profile)
+        {
+            cpu->profile[get_code_memory_index_from_pc(stage->pc)].flushes++;
+        }
+    }
+
+    if (HAS(features, FEATURE_DEBUG))
+    {
+        print_stage_content(cpu, "Execute", stage);
+    }
+}
+
+/*
+ * Memory Stage of APEX Pipeline
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+static ALWAYS_INLINE void
+APEX_memory(APEX_CPU *cpu, const CPU_Signals *sig, int features)
+{
+    const CPU_Stage *stage = &APEX_cpu_latches(cpu)->memory;
+    CPU_Stage *out = &cpu->latches[!cpu->cur].writeback;
+
+    /* Writeback retires its instruction every cycle */
+    if (!stage->has_insn)
+    {
+        out->has_insn = FALSE;
+        return;
+    }
+
+    if (stage->enter_cycle[STAGE_MEMORY] == cpu->clock
+        && is_memory_op(stage->opcode))
+    {
+        cpu->memory_ops++;
+        if (HAS(features, FEATURE_INSTRUMENT) && cpu->energy)
+        {
+            cpu->energy->events[(stage->opcode == OPCODE_LOAD
+                                 || stage->opcode == OPCODE_LDI)
+                                    ? ENERGY_MEM_READ
+                                    : ENERGY_MEM_WRITE]++;
+        }
+    }
+
+    /* Copy data from memory latch to writeback latch*/
+    *out = *stage;
+
+    if (HAS(features, FEATURE_SYSTEM))
+    {
+        /* Shared memory behind the private L1, a miss holds the stage
+         * until the interconnect completes it */
+        if (is_memory_op(out->opcode))
+        {
+            APEX_system_access(cpu->system, cpu->core_id, out, cpu->clock);
+        }
+        if (sig->memory_held)
+        {
+            out->has_insn = FALSE;
+        }
+    }
+    /* Replayed loads already hold their value, data memory is not
+     * modelled in trace-driven mode */
+    else if (!HAS(features, FEATURE_TRACE))
+    {
+        switch (out->opcode)
+        {
+            case OPCODE_LOAD:
+            case OPCODE_LDI:
+            {
+                /* Read from data memory */
+                out->result_buffer = cpu->data_memory[out->memory_address];
+                break;
+            }
+
+            case OPCODE_STORE:
+            case OPCODE_STI:
+            {
+                /* Write to data memory */
+                cpu->data_memory[out->memory_address] = out->rs1_value;
+                break;
+            }
+        }
+    }
+
+    out->enter_cycle[STAGE_WRITEBACK] = cpu->clock + 1;
+
+    if (HAS(features, FEATURE_DEBUG))
+    {
+        print_stage_content(cpu, "Memory", stage);
+    }
+}
+
+/* Appends a retiring instruction to the trace being recorded */
+static void
+record_retired(APEX_CPU *cpu, const CPU_Stage *stage)
+{
+    APEX_Trace_Record rec;
+
+    rec.pc = stage->pc;
+    rec.imm = stage->imm;
+    rec.memory_address = stage->memory_address;
+    rec.result = stage->result_buffer;
+    rec.opcode = stage->opcode;
+    rec.rd = stage->rd;
+    rec.rs1 = stage->rs1;
+    rec.rs2 = stage->rs2;
+    rec.flags = stage->branch_taken ? APEX_TRACE_TAKEN : 0;
+    APEX_trace_write(cpu->recorder, &rec);
+}
+
+/*
+ * Writeback Stage of APEX Pipeline. Runs in the first half of the cycle, the
+ * other stages read the registers it writes.
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+static ALWAYS_INLINE int
+APEX_writeback(APEX_CPU *cpu, int features)
+{
+    const CPU_Stage *stage = &APEX_cpu_latches(cpu)->writeback;
+
+    if (stage->has_insn)
+    {
+        /* Write result to register file based on instruction type */
+        switch (stage->opcode)
+        {
+            case OPCODE_ADD:
+            case OPCODE_MUL:
+            case OPCODE_DIV:
+            case OPCODE_SUB:
+            case OPCODE_ADDL:
+            case OPCODE_SUBL:
+            case OPCODE_LOAD:
+            case OPCODE_MOVC:
+            case OPCODE_AND:
+            case OPCODE_OR:
+            case OPCODE_XOR:
+            {
+                cpu->regs[stage->rd] = stage->result_buffer;
+                cpu->busy &= ~REG_BIT(stage->rd);
+                break;
+            }
+
+            case OPCODE_LDI:
+            {
+                cpu->regs[stage->rd] = stage->result_buffer;
+                cpu->regs[stage->rs1] = stage->new_result_buffer;
+                cpu->busy &= ~REG_BIT(stage->rd);
+                cpu->busy &= ~REG_BIT(stage->rs1);
+                break;
+            }
+
+            case OPCODE_STI:
+            {
+                cpu->regs[stage->rs2] = stage->new_result_buffer;
+                cpu->busy &= ~REG_BIT(stage->rs2);
+                break;
+            }
+        }
+
+        cpu->insn_completed++;
+
+        if (HAS(features, FEATURE_INSTRUMENT) && cpu->energy)
+        {
+            cpu->energy->events[ENERGY_REG_WRITE]
+                += register_writes(stage->opcode);
+        }
+
+        if (HAS(features, FEATURE_INSTRUMENT) && register_writes(stage->opcode))
+        {
+            if (cpu->values)
+            {
+                APEX_value_sample(
+                    &cpu->values[get_code_memory_index_from_pc(stage->pc)]
+                         .value,
+                    stage->result_buffer);
+            }
+            if (cpu->predictor)
+            {
+                verify_prediction(cpu, stage);
+            }
+        }
+
+        if (HAS(features, FEATURE_INSTRUMENT) && cpu->recorder)
+        {
+            record_retired(cpu, stage);
+        }
+
+        if (HAS(features, FEATURE_INSTRUMENT) && cpu->latency)
+        {
+            APEX_latency_retire(cpu->latency, stage->opcode,
+                                stage->enter_cycle, cpu->clock);
+        }
+
+        if (HAS(features, FEATURE_INSTRUMENT) && cpu->profile)
+        {
+            cpu->profile[get_code_memory_index_from_pc(stage->pc)]
+                .exec_count++;
+        }
+
+        if (HAS(features, FEATURE_DEBUG))
+        {
+            print_stage_content(cpu, "Writeback", stage);
+        }
+
+        if (stage->opcode == OPCODE_HALT)
+        {
+            /* Stop the APEX simulator */
+            if (!cpu->config.quiet)
+            {
+                state_of_arch_reg_file(cpu);
+                state_of_data_memory(cpu);
+            }
+            return TRUE;
+        }
+    }
+
+    /* Default */
+    return 0;
+}
+
+/*
+ * Allocates a cpu with reset architectural state and the given knobs, in an
+ * arena with room for extra more bytes of per-run state
+ */
+static APEX_CPU *
+cpu_alloc(const APEX_Config *config, size_t extra)
+{
+    APEX_Arena *arena;
+    APEX_CPU *cpu;
+
+    arena = APEX_arena_create(sizeof(APEX_CPU) + extra);
+    if (!arena)
+    {
+        return NULL;
+    }
+
+    cpu = APEX_arena_alloc(arena, sizeof(APEX_CPU));
+    cpu->arena = arena;
+
+    /* Initialize PC, Registers and all pipeline stages */
+    cpu->pc = 4000;
+    cpu->flags = -1;
+    memset(cpu->regs, 0, sizeof(int) * MAX_REG_FILE_SIZE);
+    memset(cpu->data_memory, 0, sizeof(int) * DATA_MEMORY_SIZE);
+
+    if (config)
+    {
+        cpu->config = *config;
+    }
+    else
+    {
+        APEX_config_default(&cpu->config);
+    }
+
+    if (cpu->config.registers < 1 || cpu->config.registers > MAX_REG_FILE_SIZE)
+    {
+        fprintf(stderr, "APEX_CPU: registers must be 1 to %d, not %d\n",
+                MAX_REG_FILE_SIZE, cpu->config.registers);
+        APEX_arena_destroy(cpu->arena);
+        return NULL;
+    }
+
+    if (cpu->config.value_prediction)
+    {
+        cpu->predictor
+            = APEX_arena_alloc(cpu->arena, sizeof(APEX_Value_Predictor));
+        if (!cpu->predictor)
+        {
+            APEX_arena_destroy(cpu->arena);
+            return NULL;
+        }
+    }
+
+    /* Per-cycle output is formatted off the simulation thread */
+    if (cpu->config.debug_messages && cpu->config.async_log)
+    {
+        cpu->log = APEX_log_start(stdout);
+    }
+
+    return cpu;
+}
+
+/*
+ * This function creates and initializes APEX cpu running a loaded program.
+ * The cpu takes its own reference on the program, so the caller may release
+ * its reference at any time.
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+APEX_CPU *
+APEX_cpu_create(APEX_Program *program, const APEX_Config *config)
+{
+    int i;
+    APEX_CPU *cpu;
+
+    if (!program)
+    {
+        return NULL;
+    }
+
+    /* Room for the profile counters, should they be enabled */
+    cpu = cpu_alloc(config, program->size * sizeof(APEX_Profile_Entry));
+    if (!cpu)
+    {
+        return NULL;
+    }
+
+    if (cpu->config.trace_start)
+    {
+        fprintf(stderr, "APEX_CPU: trace_start needs a trace, not a "
+                        "program\n");
+        APEX_log_stop(cpu->log);
+        APEX_arena_destroy(cpu->arena);
+        return NULL;
+    }
+
+    if (program->num_regs > cpu->config.registers)
+    {
+        fprintf(stderr, "APEX_CPU: program uses R%d, only %d registers\n",
+                program->num_regs - 1, cpu->config.registers);
+        APEX_log_stop(cpu->log);
+        APEX_arena_destroy(cpu->arena);
+        return NULL;
+    }
+
+    cpu->program = APEX_program_retain(program);
+    cpu->code_memory = program->code_memory;
+    cpu->code_memory_size = program->size;
+
+    /* The assembler has range checked the .word addresses */
+    for (i = 0; i < program->data_size; ++i)
+    {
+        cpu->data_memory[program->data[i].address] = program->data[i].value;
+    }
+
+    /* Skip ahead at the architectural level, the pipeline starts empty */
+    if (cpu->config.fast_forward)
+    {
+        cpu->fast_forwarded
+            = APEX_cpu_fast_forward(cpu, cpu->config.fast_forward);
+        if (cpu->fast_forwarded < 0)
+        {
+            APEX_cpu_stop(cpu);
+            return NULL;
+        }
+    }
+
+    if (cpu->config.debug_messages)
+    {
+        fprintf(stderr,
+                "APEX_CPU: Initialized APEX CPU, loaded %d instructions\n",
+                cpu->code_memory_size);
+        if (cpu->fast_forwarded)
+        {
+            fprintf(stderr, "APEX_CPU: Fast-forwarded %ld instructions\n",
+                    cpu->fast_forwarded);
+        }
+        fprintf(stderr, "APEX_CPU: PC initialized to %d\n", cpu->pc);
+        fprintf(stderr, "APEX_CPU: Printing Code Memory\n");
+        printf("%-9s %-9s %-9s %-9s %-9s\n", "opcode_str", "rd", "rs1", "rs2",
+               "imm");
+
+        for (i = 0; i < cpu->code_memory_size; ++i)
+        {
+            printf("%-9s %-9d %-9d %-9d %-9d\n", cpu->program->opcode_str[i],
+                   cpu->code_memory[i].rd, cpu->code_memory[i].rs1,
+                   cpu->code_memory[i].rs2, cpu->code_memory[i].imm);
+        }
+    }
+
+    /* To start fetch stage */
+    cpu->latches[cpu->cur].fetch.has_insn = TRUE;
+    return cpu;
+}
+
+/*
+ * This function parses the input file and creates an APEX cpu running it
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+APEX_CPU *
+APEX_cpu_init(const char *filename, const APEX_Config *config)
+{
+    APEX_CPU *cpu;
+    APEX_Program *program;
+
+    if (!filename)
+    {
+        return NULL;
+    }
+
+    /* Parse input file and create code memory */
+    program = APEX_program_load(filename);
+    if (!program)
+    {
+        return NULL;
+    }
+
+    cpu = APEX_cpu_create(program, config);
+    APEX_program_release(program);
+    return cpu;
+}
+
+/*
+ * This function creates an APEX cpu replaying a recorded instruction trace
+ * through the pipeline instead of executing code memory. Data memory is not
+ * modelled and there is no program, so per-PC profiling is unavailable.
+ */
+APEX_CPU *
+APEX_cpu_init_trace(const char *filename, const APEX_Config *config)
+{
+    APEX_CPU *cpu;
+
+    if (config && config->fast_forward)
+    {
+        fprintf(stderr, "APEX_CPU: fast_forward needs a program, not a "
+                        "trace\n");
+        return NULL;
+    }
+
+    cpu = cpu_alloc(config, 0);
+    if (!cpu)
+    {
+        return NULL;
+    }
+
+    cpu->trace = APEX_trace_open(filename);
+    if (!cpu->trace)
+    {
+        APEX_log_stop(cpu->log);
+        APEX_arena_destroy(cpu->arena);
+        return NULL;
+    }
+
+    /* Decoding restarts at the sync point before trace_start, the pipeline
+     * and registers start empty */
+    cpu->fetch_seq = cpu->config.trace_start;
+    cpu->pc = APEX_trace_get(cpu->trace, cpu->fetch_seq)->pc;
+
+    /* To start fetch stage */
+    cpu->latches[cpu->cur].fetch.has_insn = TRUE;
+    return cpu;
+}
+
+/*
+ * First half of a cycle, up to and including writeback. Returns TRUE if HALT
+ * retired, in which case nothing else moves.
+ */
+static ALWAYS_INLINE int
+begin_cycle(APEX_CPU *cpu, int features)
+{
+    const CPU_Latches *latch;
+    int busy[NUM_STAGES];
+    APEX_Log_Event *event;
+
+    if (HAS(features, FEATURE_DEBUG))
+    {
+        if (cpu->log)
+        {
+            event = APEX_log_reserve(cpu->log);
+            event->format = format_cycle;
+            event->arg[0] = cpu->clock;
+            APEX_log_commit(cpu->log);
+        }
+        else
+        {
+            printf("--------------------------------------------\n");
+            printf("Clock Cycle #: %d\n", cpu->clock);
+            printf("--------------------------------------------\n");
+        }
+    }
+
+    if (HAS(features, FEATURE_INSTRUMENT) && cpu->latency)
+    {
+        latch = APEX_cpu_latches(cpu);
+        busy[STAGE_FETCH] = latch->fetch.has_insn;
+        busy[STAGE_DECODE] = latch->decode.has_insn;
+        busy[STAGE_EXECUTE] = latch->execute.has_insn;
+        busy[STAGE_MEMORY] = latch->memory.has_insn;
+        busy[STAGE_WRITEBACK] = latch->writeback.has_insn;
+        APEX_latency_sample(cpu->latency, cpu->clock, busy);
+    }
+
+    if (APEX_writeback(cpu, features))
+    {
+        /* Halt in writeback stage, nothing else moves */
+        cpu->latches[cpu->cur].writeback.has_insn = FALSE;
+        cpu->halted = TRUE;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/* Counts the latch bits the clock edge changes, over the fields the
+ * hardware has rather than the cycle stamps kept for statistics */
+static void
+count_stage_toggles(APEX_CPU *cpu, const CPU_Stage *before,
+                    const CPU_Stage *after)
+{
+    APEX_energy_toggles(cpu->energy, (const int *)before, (const int *)after,
+                        offsetof(CPU_Stage, enter_cycle) / sizeof(int));
+}
+
+static void
+count_latch_toggles(APEX_CPU *cpu)
+{
+    const CPU_Latches *before = &cpu->latches[cpu->cur];
+    const CPU_Latches *after = &cpu->latches[!cpu->cur];
+
+    count_stage_toggles(cpu, &before->fetch, &after->fetch);
+    count_stage_toggles(cpu, &before->decode, &after->decode);
+    count_stage_toggles(cpu, &before->execute, &after->execute);
+    count_stage_toggles(cpu, &before->memory, &after->memory);
+    count_stage_toggles(cpu, &before->writeback, &after->writeback);
+    cpu->energy->events[ENERGY_CYCLE]++;
+}
+
+/* Rest of a cycle once sig->alu holds the ALU result of execute */
+static ALWAYS_INLINE void
+end_cycle(APEX_CPU *cpu, CPU_Signals *sig, int features)
+{
+    /* The other stages read the current latches and the signals, and write
+     * only the next latches they feed, so they could run in any order; back
+     * to front keeps the debug output in its usual order */
+    resolve_signals(cpu, sig, features);
+    APEX_memory(cpu, sig, features);
+    APEX_execute(cpu, sig, features);
+    APEX_decode(cpu, sig, features);
+    APEX_fetch(cpu, sig, features);
+    if (HAS(features, FEATURE_INSTRUMENT) && cpu->energy)
+    {
+        count_latch_toggles(cpu);
+    }
+    commit_cycle(cpu, sig);
+
+    if (HAS(features, FEATURE_DEBUG))
+    {
+        print_reg_file(cpu);
+    }
+
+    cpu->clock++;
+}
+
+/* The two halves of a cycle compiled for one set of features */
+typedef struct Cycle_Variant
+{
+    int (*begin)(APEX_CPU *cpu);
+    void (*end)(APEX_CPU *cpu, CPU_Signals *sig);
+} Cycle_Variant;
+
+#define CYCLE_VARIANT(features)                                                \
+    static int begin_cycle_##features(APEX_CPU *cpu)                           \
+    {                                                                          \
+        return begin_cycle(cpu, features);                                     \
+    }                                                                          \
+    static void end_cycle_##features(APEX_CPU *cpu, CPU_Signals *sig)          \
+    {                                                                          \
+        end_cycle(cpu, sig, features);                                         \
+    }
+#define CYCLE_VARIANT_ENTRY(features)                                          \
+    {begin_cycle_##features, end_cycle_##features},
+
+/* Every combination of the FEATURE_ bits, in order */
+#define FOR_EACH_VARIANT(X)                                                    \
+    X(0) X(1) X(2) X(3) X(4) X(5) X(6) X(7)                                    \
+    X(8) X(9) X(10) X(11) X(12) X(13) X(14) X(15)                              \
+    X(16) X(17) X(18) X(19) X(20) X(21) X(22) X(23)                            \
+    X(24) X(25) X(26) X(27) X(28) X(29) X(30) X(31)
+
+FOR_EACH_VARIANT(CYCLE_VARIANT)
+
+static const Cycle_Variant cycle_variants[NUM_VARIANTS] = {
+    FOR_EACH_VARIANT(CYCLE_VARIANT_ENTRY)
+};
+
+/* Features of cpu as of now, knobs and instrumentation can change between
+ * cycles */
+static inline const Cycle_Variant *
+cycle_variant(const APEX_CPU *cpu)
+{
+    int features = 0;
+
+    features |= cpu->config.debug_messages ? FEATURE_DEBUG : 0;
+    features |= cpu->config.forwarding ? FEATURE_FORWARDING : 0;
+    features |= (cpu->profile || cpu->latency || cpu->energy || cpu->values
+                 || cpu->predictor || cpu->recorder)
+                    ? FEATURE_INSTRUMENT
+                    : 0;
+    features |= cpu->trace ? FEATURE_TRACE : 0;
+    features |= cpu->system ? FEATURE_SYSTEM : 0;
+    return &cycle_variants[features];
+}
+
+/*
+ * Simulates one clock cycle, returns TRUE if HALT retired in it. The clock
+ * only advances for cycles that did not halt.
+ *
+ * Note: You are free to edit this function according to your implementation
+ */
+int
+APEX_cpu_step(APEX_CPU *cpu)
+{
+    const Cycle_Variant *variant = cycle_variant(cpu);
+    CPU_Signals sig;
+
+    if (variant->begin(cpu))
+    {
+        return TRUE;
+    }
+
+    sig.alu = alu_result(&APEX_cpu_latches(cpu)->execute);
+    variant->end(cpu, &sig);
+    return FALSE;
+}
+
+/*
+ * ALU operands of the instructions in execute across a batch of cpus, one
+ * array per field so that an optimizing build can vectorize the lane loop.
+ * Only these are gathered, the rest of the state stays in each cpu.
+ */
+typedef struct Batch_ALU
+{
+    int opcode[BATCH_LANES];
+    int rs1_value[BATCH_LANES];
+    int rs2_value[BATCH_LANES];
+    int imm[BATCH_LANES];
+    int result[BATCH_LANES];
+} Batch_ALU;
+
+/*
+ * alu_result of every lane. Each lane evaluates every operation and keeps
+ * the one its opcode selects, so lanes on different opcodes cost a select
+ * rather than a branch. The operations are done in uint32_t, which wraps
+ * where int would overflow in lanes that discard the result. Division has
+ * no vector form and traps on a zero divisor, so only the lanes that divide
+ * do it.
+ */
+static void
+batch_alu(Batch_ALU *alu)
+{
+    int lane, op;
+    uint32_t a, b, imm, r;
+
+    for (lane = 0; lane < BATCH_LANES; ++lane)
+    {
+        op = alu->opcode[lane];
+        a = (uint32_t)alu->rs1_value[lane];
+        b = (uint32_t)alu->rs2_value[lane];
+        imm = (uint32_t)alu->imm[lane];
+
+        r = 0;
+        r = (op == OPCODE_ADD) ? a + b : r;
+        r = (op == OPCODE_SUB) ? a - b : r;
+        r = (op == OPCODE_MUL) ? a * b : r;
+        r = (op == OPCODE_AND) ? (a & b) : r;
+        r = (op == OPCODE_OR) ? (a | b) : r;
+        r = (op == OPCODE_XOR) ? (a ^ b) : r;
+        r = (op == OPCODE_ADDL) ? a + imm : r;
+        r = (op == OPCODE_SUBL) ? a - imm : r;
+        r = (op == OPCODE_MOVC) ? imm : r;
+        alu->result[lane] = (int)r;
+    }
+
+    for (lane = 0; lane < BATCH_LANES; ++lane)
+    {
+        if (alu->opcode[lane] == OPCODE_DIV)
+        {
+            alu->result[lane] = alu->rs1_value[lane] / alu->rs2_value[lane];
+        }
+    }
+}
+
+/*
+ * Simulates one clock cycle of each of num_cpus independent cpus, at most
+ * BATCH_LANES, in lock-step. halted[i] is what APEX_cpu_step would have
+ * returned for cpus[i], and every cpu goes through exactly the cycle
+ * APEX_cpu_step would have simulated. Each cpu runs its own control, the
+ * ALU work of execute is the one part done for all of them at once.
+ */
+void
+APEX_cpu_step_batch(APEX_CPU *const *cpus, int num_cpus, int *halted)
+{
+    const Cycle_Variant *variants[BATCH_LANES];
+    Batch_ALU alu;
+    CPU_Signals sig;
+    const CPU_Stage *stage;
+    int lane;
+
+    /* Idle lanes compute an ADD of zeros nobody reads */
+    memset(&alu, 0, sizeof(alu));
 
-            case OPCODE_HALT:
-            {
-                break;
-            }
+    for (lane = 0; lane < num_cpus; ++lane)
+    {
+        variants[lane] = cycle_variant(cpus[lane]);
+        halted[lane] = variants[lane]->begin(cpus[lane]);
+
+        stage = &APEX_cpu_latches(cpus[lane])->execute;
+        if (!halted[lane] && stage->has_insn)
+        {
+            alu.opcode[lane] = stage->opcode;
+            alu.rs1_value[lane] = stage->rs1_value;
+            alu.rs2_value[lane] = stage->rs2_value;
+            alu.imm[lane] = stage->imm;
         }
+    }
 
-        /* Copy data from execute latch to memory latch*/
-        cpu->memory = cpu->execute;
-        cpu->execute.has_insn = FALSE;
+    batch_alu(&alu);
 
-        if (ENABLE_DEBUG_MESSAGES)
+    for (lane = 0; lane < num_cpus; ++lane)
+    {
+        if (!halted[lane])
         {
-            print_stage_content("Execute", &cpu->execute);
+            sig.alu = alu.result[lane];
+            variants[lane]->end(cpus[lane], &sig);
         }
     }
 }
 
 /*
- * Memory Stage of APEX Pipeline
+ * Waits until all logged output has been written, must be called before
+ * printing to stdout directly while a run is in progress
+ */
+void
+APEX_cpu_flush_output(APEX_CPU *cpu)
+{
+    if (cpu->log)
+    {
+        APEX_log_drain(cpu->log);
+    }
+}
+
+static void
+publish_snapshot(APEX_CPU *cpu)
+{
+    APEX_cpu_flush_output(cpu);
+    APEX_snapshot_publish(cpu->snapshot, cpu->clock, cpu->insn_completed,
+                          cpu->stall_cycles, cpu->flushes, cpu->memory_ops);
+}
+
+/*
+ * APEX CPU simulation loop, returns TRUE once HALT retires
  *
  * Note: You are free to edit this function according to your implementation
  */
-static void
-APEX_memory(APEX_CPU *cpu)
+int
+APEX_cpu_run(APEX_CPU *cpu)
 {
-    if (cpu->memory.has_insn)
+    char user_prompt_val;
+
+    while (TRUE)
     {
-        switch (cpu->memory.opcode)
+        if (APEX_cpu_step(cpu))
         {
-            case OPCODE_ADD:
-            case OPCODE_DIV:
-            case OPCODE_MUL:
-            case OPCODE_SUB:
-            case OPCODE_NOP:
-            case OPCODE_CMP:
-            case OPCODE_AND:
-            case OPCODE_OR:
-            case OPCODE_XOR:
-            case OPCODE_SUBL:
-            case OPCODE_ADDL:
+            if (cpu->snapshot)
             {
-                /* No work */
-                break;
+                publish_snapshot(cpu);
             }
 
-            case OPCODE_LOAD:
+            APEX_cpu_flush_output(cpu);
+            if (!cpu->config.quiet)
             {
-                /* Read from data memory */
-                cpu->memory.result_buffer
-                    = cpu->data_memory[cpu->memory.memory_address];
-                break;
+                printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
             }
+            return TRUE;
+        }
 
-            case OPCODE_LDI:
-            {
-                cpu->memory.result_buffer   
-                    = cpu->data_memory[cpu->memory.memory_address];
-                break;
-            }
+        if (cpu->snapshot && cpu->clock >= cpu->snapshot->next_cycle)
+        {
+            publish_snapshot(cpu);
+        }
+
+        if (cpu->config.single_step)
+        {
+            APEX_cpu_flush_output(cpu);
+            printf("Press any key to advance CPU Clock or <q> to quit:\n");
+            scanf("%c", &user_prompt_val);
 
-            case OPCODE_STORE: 
+            if ((user_prompt_val == 'Q') || (user_prompt_val == 'q'))
             {
-                /* Read from data memory */
-                cpu->data_memory[cpu->memory.memory_address]
-                    = cpu->memory.rs1_value;
-                break;
+                printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
+                return FALSE;
             }
+        }
 
-            case OPCODE_STI: 
+        if (cpu->config.max_cycles && cpu->clock >= cpu->config.max_cycles)
+        {
+            if (cpu->snapshot && cpu->clock > cpu->snapshot->last_cycle)
             {
-                /* Read from data memory */
-                cpu->data_memory[cpu->memory.memory_address]
-                    = cpu->memory.rs1_value;
-                
-                break;
+                publish_snapshot(cpu);
             }
 
-            case OPCODE_HALT:
-            case OPCODE_JUMP:
+            APEX_cpu_flush_output(cpu);
+            if (!cpu->config.quiet)
             {
-                break;
+                printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
             }
+            return FALSE;
         }
+    }
+}
 
-        /* Copy data from memory latch to writeback latch*/
-        cpu->writeback = cpu->memory;
-        cpu->memory.has_insn = FALSE;
-
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            print_stage_content("Memory", &cpu->memory);
-        }
+/*
+ * Prints every field of a pipeline latch, used by the debugger
+ */
+void
+APEX_cpu_print_latch(const APEX_CPU *cpu, const char *name,
+                     const CPU_Stage *stage, FILE *fp)
+{
+    if (!stage->has_insn)
+    {
+        fprintf(fp, "%-10s: empty\n", name);
+        return;
     }
+
+    fprintf(fp, "%-10s: pc(%d) ", name, stage->pc);
+    print_stage_instruction(fp, cpu, stage);
+    fprintf(fp, "\n%-10s  rs1_value=%d rs2_value=%d result_buffer=%d "
+                "new_result_buffer=%d memory_address=%d\n",
+            "", stage->rs1_value, stage->rs2_value, stage->result_buffer,
+            stage->new_result_buffer, stage->memory_address);
 }
 
 /*
- * Writeback Stage of APEX Pipeline
+ * This function deallocates APEX CPU.
  *
  * Note: You are free to edit this function according to your implementation
  */
-static int
-APEX_writeback(APEX_CPU *cpu)
+void
+APEX_cpu_stop(APEX_CPU *cpu)
 {
-    if (cpu->writeback.has_insn)
+    APEX_log_stop(cpu->log);
+    if (cpu->recorder)
     {
-        /* Write result to register file based on instruction type */
-        switch (cpu->writeback.opcode)
-        {
-            case OPCODE_ADD:
-            case OPCODE_MUL:
-            case OPCODE_DIV:
-            case OPCODE_SUB:
-            case OPCODE_ADDL:
-            case OPCODE_SUBL:
-            case OPCODE_LOAD:
-            case OPCODE_MOVC:
-            case OPCODE_AND:
-            case OPCODE_OR:
-            case OPCODE_XOR:
-            {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                scoreBoard[cpu->writeback.rd] = 0;
-                //collection[cpu->writeback.rd] = -1;
-                break;
-            }
+        APEX_trace_writer_close(cpu->recorder);
+    }
+    APEX_latency_free(cpu->latency);
+    APEX_energy_free(cpu->energy);
+    APEX_snapshot_close(cpu->snapshot);
+    APEX_trace_close(cpu->trace);
+    APEX_program_release(cpu->program);
+
+    /* The cpu and the rest of its state go with the arena */
+    APEX_arena_destroy(cpu->arena);
+}
 
-            case OPCODE_LDI:
-            {
-                cpu->regs[cpu->writeback.rd] = cpu->writeback.result_buffer;
-                cpu->regs[cpu->writeback.rs1] = cpu->writeback.new_result_buffer;
-                scoreBoard[cpu->writeback.rd] = 0;
-                scoreBoard[cpu->writeback.rs1] = 0;
-                break;
-            }
+/*
+ * Allocates the per-PC counters, must be called before APEX_cpu_run. There
+ * are none in trace-driven mode.
+ */
+int
+APEX_cpu_enable_profile(APEX_CPU *cpu)
+{
+    if (!cpu->profile && !cpu->trace)
+    {
+        cpu->profile = APEX_arena_alloc(
+            cpu->arena, cpu->code_memory_size * sizeof(APEX_Profile_Entry));
+    }
 
-            case OPCODE_STORE:
-            case OPCODE_NOP:
-            case OPCODE_BP:
-            case OPCODE_BNP:
-            case OPCODE_BZ:
-            case OPCODE_BNZ:
-            case OPCODE_JUMP:
-            {
-                //no work to be done
-                break;
-            }
+    return cpu->profile != NULL;
+}
 
-            case OPCODE_STI:
-            {
-                cpu->regs[cpu->writeback.rs2] = cpu->writeback.new_result_buffer;
-                scoreBoard[cpu->writeback.rs2] = 0;
-                break;
-            }
+/*
+ * Allocates the per-PC value and address histories, must be called before
+ * APEX_cpu_run. Like the profile, there are none in trace-driven mode.
+ */
+int
+APEX_cpu_enable_values(APEX_CPU *cpu)
+{
+    if (!cpu->values && !cpu->trace)
+    {
+        cpu->values = APEX_arena_alloc(
+            cpu->arena, cpu->code_memory_size * sizeof(APEX_Value_Entry));
+    }
 
-        }
+    return cpu->values != NULL;
+}
 
-        cpu->insn_completed++;
-        cpu->writeback.has_insn = FALSE;
-        
-        
-        if(stall == TRUE)
-        {
-            stall = FALSE;
-        }
+/*
+ * Records every instruction retired from now on into a trace file, which
+ * replays with APEX_cpu_init_trace
+ */
+int
+APEX_cpu_record_trace(APEX_CPU *cpu, const char *filename)
+{
+    if (!cpu->recorder)
+    {
+        cpu->recorder = APEX_trace_writer_open(filename);
+    }
 
-        if (ENABLE_DEBUG_MESSAGES)
-        {
-            print_stage_content("Writeback", &cpu->writeback);
-        }
+    return cpu->recorder != NULL;
+}
+
+/*
+ * Starts collecting stage latency histograms and occupancy, must be called
+ * before APEX_cpu_run
+ */
+int
+APEX_cpu_enable_latency(APEX_CPU *cpu)
+{
+    if (!cpu->latency)
+    {
+        cpu->latency = APEX_latency_create(cpu->config.occupancy_interval);
+    }
+
+    return cpu->latency != NULL;
+}
 
-        if (cpu->writeback.opcode == OPCODE_HALT)
+/*
+ * Starts counting the events of the energy model, must be called before
+ * APEX_cpu_run. Coefficients are read from the file of that name, or left at
+ * their defaults if it is NULL.
+ */
+int
+APEX_cpu_enable_energy(APEX_CPU *cpu, const char *coefficients)
+{
+    if (!cpu->energy)
+    {
+        cpu->energy = APEX_energy_create();
+        if (!cpu->energy)
         {
-            /* Stop the APEX simulator */
-            state_of_arch_reg_file(cpu);
-            state_of_data_memory(cpu);
-            return TRUE;
+            return FALSE;
         }
     }
 
-    /* Default */
-    return 0;
+    return !coefficients || APEX_energy_load(cpu->energy, coefficients) == 0;
 }
 
 /*
- * This function creates and initializes APEX cpu.
- *
- * Note: You are free to edit this function according to your implementation
+ * Publishes interval statistics to target every snapshot_interval cycles of
+ * APEX_cpu_run, see APEX_snapshot_open for the targets
  */
-APEX_CPU *
-APEX_cpu_init(const char *filename)
+int
+APEX_cpu_enable_snapshots(APEX_CPU *cpu, const char *target)
 {
-    int i;
-    APEX_CPU *cpu;
-
-    if (!filename)
+    if (!cpu->snapshot)
     {
-        return NULL;
+        cpu->snapshot
+            = APEX_snapshot_open(target, cpu->config.snapshot_interval);
     }
 
-    cpu = calloc(1, sizeof(APEX_CPU));
+    return cpu->snapshot != NULL;
+}
 
-    if (!cpu)
+typedef struct Profile_Row
+{
+    int index;
+    unsigned long total_cycles;
+} Profile_Row;
+
+static int
+compare_profile_rows(const void *a, const void *b)
+{
+    const Profile_Row *ra = a;
+    const Profile_Row *rb = b;
+
+    if (ra->total_cycles != rb->total_cycles)
     {
-        return NULL;
+        return (ra->total_cycles < rb->total_cycles) ? 1 : -1;
     }
 
-    /* Initialize PC, Registers and all pipeline stages */
-    cpu->pc = 4000;
-    memset(cpu->regs, 0, sizeof(int) * REG_FILE_SIZE);
-    memset(cpu->data_memory, 0, sizeof(int) * DATA_MEMORY_SIZE);
-    cpu->single_step = ENABLE_SINGLE_STEP;
+    /* Keep program order between instructions of equal cost */
+    return ra->index - rb->index;
+}
 
-    /* Parse input file and create code memory */
-    cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
-    if (!cpu->code_memory)
+/*
+ * Prints code memory annotated with per-PC costs, most expensive first.
+ * Total cycles counts one issue cycle per execution, plus the decode stall
+ * cycles and the flush bubbles the instruction is responsible for.
+ */
+void
+APEX_cpu_print_profile(const APEX_CPU *cpu, FILE *fp)
+{
+    int i;
+    Profile_Row *rows;
+    const APEX_Profile_Entry *entry;
+
+    if (!cpu->profile)
     {
-        free(cpu);
-        return NULL;
+        return;
     }
 
-    if (ENABLE_DEBUG_MESSAGES)
+    rows = calloc(cpu->code_memory_size, sizeof(Profile_Row));
+    if (!rows)
     {
-        fprintf(stderr,
-                "APEX_CPU: Initialized APEX CPU, loaded %d instructions\n",
-                cpu->code_memory_size);
-        fprintf(stderr, "APEX_CPU: PC initialized to %d\n", cpu->pc);
-        fprintf(stderr, "APEX_CPU: Printing Code Memory\n");
-        printf("%-9s %-9s %-9s %-9s %-9s\n", "opcode_str", "rd", "rs1", "rs2",
-               "imm");
+        return;
+    }
 
-        for (i = 0; i < cpu->code_memory_size; ++i)
-        {
-            printf("%-9s %-9d %-9d %-9d %-9d\n", cpu->code_memory[i].opcode_str,
-                   cpu->code_memory[i].rd, cpu->code_memory[i].rs1,
-                   cpu->code_memory[i].rs2, cpu->code_memory[i].imm);
-        }
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        entry = &cpu->profile[i];
+        rows[i].index = i;
+        rows[i].total_cycles = entry->exec_count + entry->stall_cycles
+                               + entry->flushes * BRANCH_FLUSH_PENALTY;
     }
 
-    /* To start fetch stage */
-    cpu->fetch.has_insn = TRUE;
-    return cpu;
+    qsort(rows, cpu->code_memory_size, sizeof(Profile_Row),
+          compare_profile_rows);
+
+    fprintf(fp, "APEX_CPU: Hot-spot profile, cycles = %d instructions = %d\n",
+            cpu->clock, cpu->insn_completed);
+    fprintf(fp, "%-6s %-10s %-10s %-10s %-10s %-7s %s\n", "pc", "total",
+            "executed", "stalls", "flushes", "%cycles", "instruction");
+
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        entry = &cpu->profile[rows[i].index];
+        fprintf(fp, "%-6d %-10lu %-10lu %-10lu %-10lu %-7.2f ",
+                4000 + rows[i].index * 4, rows[i].total_cycles,
+                entry->exec_count, entry->stall_cycles, entry->flushes,
+                cpu->clock ? 100.0 * rows[i].total_cycles / cpu->clock : 0.0);
+        print_instruction(fp, &cpu->code_memory[rows[i].index],
+                          cpu->program->opcode_str[rows[i].index]);
+        fprintf(fp, "\n");
+    }
+
+    free(rows);
 }
 
 /*
- * APEX CPU simulation loop
- *
- * Note: You are free to edit this function according to your implementation
+ * Prints the end of run result in a stable, diffable form: the counts, the
+ * architectural state, and a 32-bit FNV-1a checksum of data memory
  */
 void
-APEX_cpu_run(APEX_CPU *cpu)
+APEX_cpu_print_result(const APEX_CPU *cpu, FILE *fp)
 {
-    char user_prompt_val;
+    uint32_t checksum = 2166136261u;
+    uint32_t word;
+    int i, byte;
 
-    while (TRUE)
+    for (i = 0; i < DATA_MEMORY_SIZE; ++i)
     {
-        if (ENABLE_DEBUG_MESSAGES)
+        word = (uint32_t)cpu->data_memory[i];
+        for (byte = 0; byte < 4; ++byte)
         {
-            printf("--------------------------------------------\n");
-            printf("Clock Cycle #: %d\n", cpu->clock);
-            printf("--------------------------------------------\n");
+            checksum = (checksum ^ ((word >> (8 * byte)) & 0xff)) * 16777619u;
         }
+    }
 
-        if (APEX_writeback(cpu))
-        {
-            /* Halt in writeback stage */
-            printf("APEX_CPU: Simulation Complete, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
-            break;
-        }
+    fprintf(fp, "halted %d\n", cpu->halted ? 1 : 0);
+    fprintf(fp, "cycles %d\n", cpu->clock);
+    fprintf(fp, "instructions %d\n", cpu->insn_completed);
+    fprintf(fp, "fast_forwarded %ld\n", cpu->fast_forwarded);
+    fprintf(fp, "stall_cycles %lu\n", cpu->stall_cycles);
+    fprintf(fp, "flushes %lu\n", cpu->flushes);
+    fprintf(fp, "memory_ops %lu\n", cpu->memory_ops);
+    fprintf(fp, "pc %d\n", cpu->pc);
+    fprintf(fp, "zero_flag %d\n", APEX_cpu_zero_flag(cpu) ? 1 : 0);
+    fprintf(fp, "positive_flag %d\n", APEX_cpu_positive_flag(cpu) ? 1 : 0);
+    for (i = 0; i < cpu->config.registers; ++i)
+    {
+        fprintf(fp, "R%d %d\n", i, cpu->regs[i]);
+    }
+    fprintf(fp, "data_memory_checksum %08x\n", checksum);
+    if (cpu->predictor)
+    {
+        fprintf(fp, "value_predictions %lu\n", cpu->predictor->predictions);
+        fprintf(fp, "value_predictions_correct %lu\n",
+                cpu->predictor->correct);
+        fprintf(fp, "stalls_removed %lu\n", cpu->predictor->stalls_removed);
+    }
+}
 
-        APEX_memory(cpu);
-        APEX_execute(cpu);
-        APEX_decode(cpu);
-        APEX_fetch(cpu);
+/* Prints a history of APEX_cpu_print_values as percentages */
+static void
+print_value_history(FILE *fp, const APEX_Value_History *history)
+{
+    unsigned long classified = history->samples ? history->samples - 1 : 0;
 
-        print_reg_file(cpu);
+    if (!classified)
+    {
+        fprintf(fp, "%-10lu %-6s %-6s %-6s %-9s ", history->samples, "-", "-",
+                "-", APEX_value_class(history));
+        return;
+    }
 
-        if (cpu->single_step)
-        {
-            printf("Press any key to advance CPU Clock or <q> to quit:\n");
-            scanf("%c", &user_prompt_val);
+    fprintf(fp, "%-10lu %-6.1f %-6.1f %-6.1f %-9s ", history->samples,
+            100.0 * history->constant / classified,
+            100.0 * history->strided / classified,
+            100.0 * history->random / classified, APEX_value_class(history));
+}
 
-            if ((user_prompt_val == 'Q') || (user_prompt_val == 'q'))
-            {
-                printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
-                break;
-            }
-        }
+/*
+ * Prints for every instruction of code memory the results it wrote back and
+ * the addresses it accessed: how many, the percentage that were constant,
+ * strided or random, and the class they fall in
+ */
+void
+APEX_cpu_print_values(const APEX_CPU *cpu, FILE *fp)
+{
+    const APEX_Value_Entry *entry;
+    int i;
+
+    if (!cpu->values)
+    {
+        return;
+    }
+
+    fprintf(fp, "APEX_CPU: Value profile, cycles = %d instructions = %d\n",
+            cpu->clock, cpu->insn_completed);
+    fprintf(fp, "%-6s %-10s %-6s %-6s %-6s %-9s %-10s %-6s %-6s %-6s %-9s %s\n",
+            "pc", "values", "%const", "%strd", "%rand", "class", "addresses",
+            "%const", "%strd", "%rand", "class", "instruction");
 
-        cpu->clock++;
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        entry = &cpu->values[i];
+        fprintf(fp, "%-6d ", 4000 + i * 4);
+        print_value_history(fp, &entry->value);
+        print_value_history(fp, &entry->address);
+        print_instruction(fp, &cpu->code_memory[i],
+                          cpu->program->opcode_str[i]);
+        fprintf(fp, "\n");
     }
+
+    APEX_cpu_print_prediction(cpu, fp);
 }
 
 /*
- * This function deallocates APEX CPU.
- *
- * Note: You are free to edit this function according to your implementation
+ * Prints how the stride value predictor did, and how many of the decode
+ * stall cycles spent waiting on registers it would have removed
  */
 void
-APEX_cpu_stop(APEX_CPU *cpu)
+APEX_cpu_print_prediction(const APEX_CPU *cpu, FILE *fp)
 {
-    free(cpu->code_memory);
-    free(cpu);
-}
\ No newline at end of file
+    const APEX_Value_Predictor *pred = cpu->predictor;
+    unsigned long waits;
+    int i;
+
+    if (!pred)
+    {
+        return;
+    }
+
+    /* Stalls still charged to a register at the end were not removed */
+    waits = pred->stalls_removed + pred->stalls_kept;
+    for (i = 0; i < MAX_REG_FILE_SIZE; ++i)
+    {
+        waits += pred->waiting[i];
+    }
+    fprintf(fp, "APEX_CPU: Value prediction, predictions = %lu correct = %lu "
+                "(%.1f%%), register stalls = %lu removed = %lu (%.1f%%)\n",
+            pred->predictions, pred->correct,
+            pred->predictions ? 100.0 * pred->correct / pred->predictions : 0.0,
+            waits, pred->stalls_removed,
+            waits ? 100.0 * pred->stalls_removed / waits : 0.0);
+}
@@ -9,24 +9,88 @@
 #ifndef _APEX_CPU_H_
 #define _APEX_CPU_H_
 
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "apex_energy.h"
+#include "apex_log.h"
 #include "apex_macros.h"
+#include "apex_stats.h"
+#include "apex_trace.h"
+#include "apex_value.h"
 
-/* Format of an APEX instruction  */
+/* Format of an APEX instruction, packed to the fields fetch reads. The
+ * mnemonic text lives in the program's cold side table. */
 typedef struct APEX_Instruction
 {
-    char opcode_str[128];
-    int opcode;
-    int rd;
-    int rs1;
-    int rs2;
-    int imm;
+    uint8_t opcode;
+    uint16_t rd;
+    uint16_t rs1;
+    uint16_t rs2;
+    int32_t imm;
 } APEX_Instruction;
 
+/* Mnemonic text of an instruction as written in the input file */
+typedef char APEX_Opcode_Str[OPCODE_STR_LEN];
+
+/* Initial value of a data memory word, from a .word directive */
+typedef struct APEX_Data_Word
+{
+    int address;
+    int value;
+} APEX_Data_Word;
+
+/* Loaded program image, immutable after loading and shared by reference */
+typedef struct APEX_Program
+{
+    atomic_int refcount;                 /* Owners, see APEX_program_release */
+    int size;                            /* Number of instructions */
+    const APEX_Instruction *code_memory; /* Parsed instructions */
+    const APEX_Opcode_Str *opcode_str;   /* Mnemonics, only for printing */
+    int data_size;                       /* Number of data initializers */
+    const APEX_Data_Word *data;          /* Initial data memory contents */
+    int num_regs;                        /* Highest register used plus one */
+} APEX_Program;
+
+/* Per-PC hot-spot counters, indexed like code memory */
+typedef struct APEX_Profile_Entry
+{
+    unsigned long exec_count;   /* Times retired in writeback */
+    unsigned long stall_cycles; /* Cycles spent stalled in decode */
+    unsigned long flushes;      /* Taken branches that flushed fetch/decode */
+} APEX_Profile_Entry;
+
+/* Run-time knobs of a simulator instance, see APEX_config_set for names */
+typedef struct APEX_Config
+{
+    int forwarding;     /* Let decode read results from `collection` */
+    int debug_messages; /* Print stage contents every cycle */
+    int single_step;    /* Wait for user input after every cycle */
+    int quiet;          /* Suppress the end of run summary and state dumps */
+    int max_cycles;     /* Stop after this many cycles, 0 for no limit */
+    int occupancy_interval; /* Cycles per stage occupancy sample */
+    int snapshot_interval;  /* Cycles between live statistics snapshots */
+    int async_log;      /* Format debug output on a background thread */
+    int registers;      /* Architectural registers, 1 to MAX_REG_FILE_SIZE */
+    int l1_lines;       /* Lines per private L1 of a multi-core system */
+    int bus_latency;    /* Cycles a bus transaction holds the bus */
+    int memory_latency; /* Extra cycles when memory supplies a line */
+    int fast_forward;   /* Instructions run functionally before the pipeline */
+    int value_prediction; /* Model the stride value predictor */
+    int trace_start;    /* Record of a -t trace the replay starts at */
+} APEX_Config;
+
+/* Bit of register reg in the busy and forwarded sets */
+#define REG_BIT(reg) ((uint64_t)1 << (reg))
+
+typedef struct APEX_System APEX_System;
+typedef struct APEX_Arena APEX_Arena;
+
 /* Model of CPU stage latch */
 typedef struct CPU_Stage
 {
     int pc;
-    char opcode_str[128];
     int opcode;
     int rs1;
     int rs2;
@@ -38,33 +102,115 @@ typedef struct CPU_Stage
     int new_result_buffer;
     int memory_address;
     int has_insn;
+    int branch_taken;  /* Execute redirected fetch */
+    int enter_cycle[NUM_STAGES]; /* Cycle each stage was entered, -1 if not yet */
+    int has_prediction; /* Value predictor guessed result_buffer at issue */
+    int predicted;
+    unsigned long seq; /* Trace record number, trace-driven mode only */
 } CPU_Stage;
 
+/* The latch of every stage, holding the instruction the stage works on */
+typedef struct CPU_Latches
+{
+    CPU_Stage fetch;
+    CPU_Stage decode;
+    CPU_Stage execute;
+    CPU_Stage memory;
+    CPU_Stage writeback;
+} CPU_Latches;
+
 /* Model of APEX CPU */
 typedef struct APEX_CPU
 {
     int pc;                        /* Current program counter */
     int clock;                     /* Clock cycles elapsed */
     int insn_completed;            /* Instructions retired */
-    int regs[REG_FILE_SIZE];       /* Integer register file */
+    int regs[MAX_REG_FILE_SIZE];   /* Integer register file */
+    APEX_Program *program;         /* Shared program image, one reference */
     int code_memory_size;          /* Number of instruction in the input file */
-    APEX_Instruction *code_memory; /* Code Memory */
+    const APEX_Instruction *code_memory; /* Code Memory of the program */
     int data_memory[DATA_MEMORY_SIZE]; /* Data Memory */
-    int single_step;               /* Wait for user input after every cycle */
-    int zero_flag;                 /* {TRUE, FALSE} Used by BZ and BNZ to branch */
-    int positive_flag;
-    int fetch_from_next_cycle;
+    APEX_Config config;            /* Run-time knobs */
+    int flags;                     /* Last result the flags derive from */
+    uint64_t busy;                 /* Registers with a write pending */
+    uint64_t forwarded;            /* Registers with a result in `collection`, never -1 */
+    int collection[MAX_REG_FILE_SIZE]; /* Last result forwarded per register */
+    int stall;                     /* Last stall decided, kept while decode is empty */
+    int fetch_held;                /* Fetch keeps its instruction next cycle */
+    int halted;                    /* HALT has retired */
+    unsigned long stall_cycles;    /* Cycles decode spent stalled */
+    unsigned long flushes;         /* Taken branches that flushed the front end */
+    unsigned long memory_ops;      /* Loads and stores through the memory stage */
+    APEX_Profile_Entry *profile;   /* Per-PC counters, NULL unless profiling */
+    APEX_Trace *trace;             /* Replayed trace, NULL when executing code memory */
+    unsigned long fetch_seq;       /* Next trace record to fetch */
+    APEX_Trace_Writer *recorder;   /* Retired instruction trace, NULL unless recording */
+    APEX_Latency_Stats *latency;   /* Stage latency histograms, NULL unless enabled */
+    APEX_Snapshot *snapshot;       /* Live statistics target, NULL unless enabled */
+    APEX_Energy *energy;           /* Activity counters, NULL unless estimating energy */
+    APEX_Value_Entry *values;      /* Per-PC value and address profile, NULL unless profiling */
+    APEX_Value_Predictor *predictor; /* NULL unless config.value_prediction */
+    APEX_Log *log;                 /* Asynchronous debug output, NULL for printf */
+    APEX_System *system;           /* Shared memory of a multi-core system, or NULL */
+    int core_id;                   /* Index of this cpu in its system */
+    APEX_Arena *arena;             /* Holds the cpu and its per-run state */
+    long fast_forwarded;           /* Instructions skipped by fast_forward */
 
-    /* Pipeline stages */
-    CPU_Stage fetch;
-    CPU_Stage decode;
-    CPU_Stage execute;
-    CPU_Stage memory;
-    CPU_Stage writeback;
+    /* Pipeline latches: the current set, and the one the stages write for
+     * the next cycle. The clock edge swaps them. */
+    CPU_Latches latches[2];
+    int cur;                       /* Index of the current set */
 } APEX_CPU;
 
-APEX_Instruction *create_code_memory(const char *filename, int *size);
-APEX_CPU *APEX_cpu_init(const char *filename);
-void APEX_cpu_run(APEX_CPU *cpu);
+/* Latches as of the start of the current cycle */
+static inline const CPU_Latches *
+APEX_cpu_latches(const APEX_CPU *cpu)
+{
+    return &cpu->latches[cpu->cur];
+}
+
+/* Flags used by BZ/BNZ and BP/BNP, derived on demand from the last ALU
+ * result that sets them; CMP stores 0 for equal and 1 for greater */
+static inline int
+APEX_cpu_zero_flag(const APEX_CPU *cpu)
+{
+    return cpu->flags == 0;
+}
+
+static inline int
+APEX_cpu_positive_flag(const APEX_CPU *cpu)
+{
+    return cpu->flags > 0;
+}
+
+int assemble_program(FILE *fp, const char *name, APEX_Program *program);
+int assemble_buffer(char *buffer, size_t len, const char *name,
+                    APEX_Program *program);
+APEX_Program *APEX_program_load(const char *filename);
+APEX_Program *APEX_program_retain(APEX_Program *program);
+void APEX_program_release(APEX_Program *program);
+void APEX_config_default(APEX_Config *config);
+int APEX_config_set(APEX_Config *config, const char *key, const char *value);
+int APEX_config_sweepable(const char *key);
+void APEX_config_print_keys(FILE *fp);
+APEX_CPU *APEX_cpu_create(APEX_Program *program, const APEX_Config *config);
+APEX_CPU *APEX_cpu_init(const char *filename, const APEX_Config *config);
+APEX_CPU *APEX_cpu_init_trace(const char *filename, const APEX_Config *config);
+int APEX_cpu_step(APEX_CPU *cpu);
+void APEX_cpu_step_batch(APEX_CPU *const *cpus, int num_cpus, int *halted);
+int APEX_cpu_run(APEX_CPU *cpu);
+void APEX_cpu_flush_output(APEX_CPU *cpu);
+void APEX_cpu_print_latch(const APEX_CPU *cpu, const char *name,
+                          const CPU_Stage *stage, FILE *fp);
 void APEX_cpu_stop(APEX_CPU *cpu);
+int APEX_cpu_enable_profile(APEX_CPU *cpu);
+int APEX_cpu_record_trace(APEX_CPU *cpu, const char *filename);
+int APEX_cpu_enable_latency(APEX_CPU *cpu);
+int APEX_cpu_enable_snapshots(APEX_CPU *cpu, const char *target);
+int APEX_cpu_enable_energy(APEX_CPU *cpu, const char *coefficients);
+int APEX_cpu_enable_values(APEX_CPU *cpu);
+void APEX_cpu_print_profile(const APEX_CPU *cpu, FILE *fp);
+void APEX_cpu_print_result(const APEX_CPU *cpu, FILE *fp);
+void APEX_cpu_print_values(const APEX_CPU *cpu, FILE *fp);
+void APEX_cpu_print_prediction(const APEX_CPU *cpu, FILE *fp);
 #endif
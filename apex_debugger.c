@@ -0,0 +1,443 @@
+/*
+ * apex_debugger.c
+ * Contains the cycle level interactive debugger: PC breakpoints, register and
+ * data memory watchpoints, run-until-event and latch inspection
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_cpu.h"
+#include "apex_debugger.h"
+#include "apex_macros.h"
+
+#define MAX_BREAKPOINTS 32
+#define MAX_WATCHPOINTS 32
+
+/* Events that end a run command */
+#define STOP_ON_STALL 0x1
+#define STOP_ON_FLUSH 0x2
+
+typedef struct Watchpoint
+{
+    int is_memory; /* Data memory address if set, register number otherwise */
+    int index;
+    int old_value;
+} Watchpoint;
+
+typedef struct Debugger
+{
+    APEX_CPU *cpu;
+    int breakpoints[MAX_BREAKPOINTS];
+    int num_breakpoints;
+    Watchpoint watchpoints[MAX_WATCHPOINTS];
+    int num_watchpoints;
+    int verbose; /* Keep per-cycle output while running */
+} Debugger;
+
+static void
+print_help(void)
+{
+    printf("Commands:\n"
+           "  s [N]            Run N cycles (default 1)\n"
+           "  c                Continue until a breakpoint, watchpoint or HALT\n"
+           "  b <pc>           Break before the instruction at pc is fetched\n"
+           "  w r<N> | m<addr> Watch a register or data memory word\n"
+           "  d <num>          Delete breakpoint/watchpoint <num> from 'i'\n"
+           "  u stall | flush  Run until decode stalls or a branch flushes\n"
+           "  i                List breakpoints and watchpoints\n"
+           "  p [latch]        Print fetch, decode, execute, memory, writeback\n"
+           "  r                Print registers and flags\n"
+           "  m <addr> [n]     Print n data memory words\n"
+           "  v                Toggle per-cycle output while running\n"
+           "  q                Quit\n");
+}
+
+static int
+watch_value(const APEX_CPU *cpu, const Watchpoint *wp)
+{
+    return wp->is_memory ? cpu->data_memory[wp->index] : cpu->regs[wp->index];
+}
+
+static void
+print_status(const APEX_CPU *cpu)
+{
+    printf("cycle %d, pc %d, instructions %d, stalls %lu, flushes %lu\n",
+           cpu->clock, cpu->pc, cpu->insn_completed, cpu->stall_cycles,
+           cpu->flushes);
+}
+
+static void
+print_latches(const APEX_CPU *cpu, const char *which)
+{
+    static const char *names[]
+        = {"fetch", "decode", "execute", "memory", "writeback"};
+    const CPU_Latches *latch = APEX_cpu_latches(cpu);
+    const CPU_Stage *stages[]
+        = {&latch->fetch, &latch->decode, &latch->execute, &latch->memory,
+           &latch->writeback};
+    int i, found = FALSE;
+
+    for (i = 0; i < 5; ++i)
+    {
+        if (!which || strncmp(names[i], which, strlen(which)) == 0)
+        {
+            APEX_cpu_print_latch(cpu, names[i], stages[i], stdout);
+            found = TRUE;
+        }
+    }
+
+    if (!found)
+    {
+        printf("Unknown latch '%s'\n", which);
+    }
+}
+
+static void
+print_registers(const APEX_CPU *cpu)
+{
+    int i;
+
+    for (i = 0; i < cpu->config.registers; ++i)
+    {
+        printf("R%-3d[%-6d]%s ", i, cpu->regs[i],
+               (cpu->busy & REG_BIT(i)) ? "*" : " ");
+        if (i % 8 == 7)
+        {
+            printf("\n");
+        }
+    }
+    if (i % 8)
+    {
+        printf("\n");
+    }
+    printf("Z=%d P=%d  (* pending write)\n", APEX_cpu_zero_flag(cpu),
+           APEX_cpu_positive_flag(cpu));
+}
+
+static void
+print_memory(const APEX_CPU *cpu, int addr, int count)
+{
+    int i;
+
+    for (i = addr < 0 ? 0 : addr; i < addr + count && i < DATA_MEMORY_SIZE;
+         ++i)
+    {
+        printf("MEM[%d] = %d\n", i, cpu->data_memory[i]);
+    }
+}
+
+/*
+ * Runs at most max_cycles cycles (0 for no limit) and reports why it stopped.
+ * Breakpoints and watchpoints are checked after every cycle.
+ */
+static void
+run_cycles(Debugger *dbg, long max_cycles, int stop_on)
+{
+    APEX_CPU *cpu = dbg->cpu;
+    unsigned long stalls, flushes;
+    long cycles = 0;
+    int i, pc, value, halted;
+
+    if (cpu->halted)
+    {
+        printf("Program has halted\n");
+        return;
+    }
+
+    cpu->config.debug_messages = dbg->verbose;
+    for (i = 0; i < dbg->num_watchpoints; ++i)
+    {
+        dbg->watchpoints[i].old_value = watch_value(cpu, &dbg->watchpoints[i]);
+    }
+
+    while (TRUE)
+    {
+        stalls = cpu->stall_cycles;
+        flushes = cpu->flushes;
+        pc = cpu->pc;
+
+        /* Per-cycle output must be out before any message below */
+        halted = APEX_cpu_step(cpu);
+        APEX_cpu_flush_output(cpu);
+
+        if (halted)
+        {
+            printf("HALT retired\n");
+            break;
+        }
+        cycles++;
+
+        if ((stop_on & STOP_ON_STALL) && cpu->stall_cycles != stalls)
+        {
+            printf("Decode stalled at pc %d\n",
+                   APEX_cpu_latches(cpu)->decode.pc);
+            break;
+        }
+
+        if ((stop_on & STOP_ON_FLUSH) && cpu->flushes != flushes)
+        {
+            printf("Branch at pc %d flushed the pipeline\n",
+                   APEX_cpu_latches(cpu)->memory.pc);
+            break;
+        }
+
+        /* Only a PC change hits, so a stalled fetch does not stop again */
+        for (i = 0; i < dbg->num_breakpoints; ++i)
+        {
+            if (cpu->pc != pc && cpu->pc == dbg->breakpoints[i])
+            {
+                break;
+            }
+        }
+        if (i < dbg->num_breakpoints)
+        {
+            printf("Breakpoint %d, pc %d\n", i, cpu->pc);
+            break;
+        }
+
+        for (i = 0; i < dbg->num_watchpoints; ++i)
+        {
+            value = watch_value(cpu, &dbg->watchpoints[i]);
+            if (value != dbg->watchpoints[i].old_value)
+            {
+                printf("Watchpoint %d, %s%d: %d -> %d\n",
+                       dbg->num_breakpoints + i,
+                       dbg->watchpoints[i].is_memory ? "MEM" : "R",
+                       dbg->watchpoints[i].index,
+                       dbg->watchpoints[i].old_value, value);
+                break;
+            }
+        }
+        if (i < dbg->num_watchpoints)
+        {
+            break;
+        }
+
+        if (max_cycles && cycles >= max_cycles)
+        {
+            break;
+        }
+    }
+
+    cpu->config.debug_messages = FALSE;
+    print_status(cpu);
+}
+
+static void
+add_watchpoint(Debugger *dbg, const char *arg)
+{
+    Watchpoint *wp;
+    char *end;
+    long index, limit;
+
+    if (dbg->num_watchpoints == MAX_WATCHPOINTS)
+    {
+        printf("Too many watchpoints\n");
+        return;
+    }
+
+    if (!arg || (arg[0] != 'r' && arg[0] != 'R' && arg[0] != 'm'
+                 && arg[0] != 'M'))
+    {
+        printf("Usage: w r<N> | m<addr>\n");
+        return;
+    }
+
+    index = strtol(arg + 1, &end, 0);
+    wp = &dbg->watchpoints[dbg->num_watchpoints];
+    wp->is_memory = (arg[0] == 'm' || arg[0] == 'M');
+    limit = wp->is_memory ? DATA_MEMORY_SIZE : dbg->cpu->config.registers;
+    if (end == arg + 1 || index < 0 || index >= limit)
+    {
+        printf("Invalid watch target '%s'\n", arg);
+        return;
+    }
+
+    wp->index = (int)index;
+    dbg->num_watchpoints++;
+}
+
+static void
+delete_point(Debugger *dbg, int num)
+{
+    if (num >= 0 && num < dbg->num_breakpoints)
+    {
+        memmove(&dbg->breakpoints[num], &dbg->breakpoints[num + 1],
+                (dbg->num_breakpoints - num - 1) * sizeof(int));
+        dbg->num_breakpoints--;
+        return;
+    }
+
+    num -= dbg->num_breakpoints;
+    if (num >= 0 && num < dbg->num_watchpoints)
+    {
+        memmove(&dbg->watchpoints[num], &dbg->watchpoints[num + 1],
+                (dbg->num_watchpoints - num - 1) * sizeof(Watchpoint));
+        dbg->num_watchpoints--;
+        return;
+    }
+
+    printf("No such breakpoint or watchpoint\n");
+}
+
+static void
+list_points(const Debugger *dbg)
+{
+    int i;
+
+    for (i = 0; i < dbg->num_breakpoints; ++i)
+    {
+        printf("%-3d break pc %d\n", i, dbg->breakpoints[i]);
+    }
+
+    for (i = 0; i < dbg->num_watchpoints; ++i)
+    {
+        printf("%-3d watch %s%d\n", dbg->num_breakpoints + i,
+               dbg->watchpoints[i].is_memory ? "MEM" : "R",
+               dbg->watchpoints[i].index);
+    }
+}
+
+void
+APEX_debugger_run(APEX_CPU *cpu)
+{
+    Debugger dbg;
+    char line[256];
+    char *cmd, *arg, *arg2;
+
+    memset(&dbg, 0, sizeof(dbg));
+    dbg.cpu = cpu;
+    cpu->config.debug_messages = FALSE;
+    cpu->config.single_step = FALSE;
+
+    printf("APEX debugger, 'h' for help\n");
+    print_status(cpu);
+
+    while (TRUE)
+    {
+        printf("(apex) ");
+        fflush(stdout);
+
+        if (!fgets(line, sizeof(line), stdin))
+        {
+            break;
+        }
+
+        cmd = strtok(line, " \t\n");
+        arg = strtok(NULL, " \t\n");
+        arg2 = strtok(NULL, " \t\n");
+
+        if (!cmd)
+        {
+            continue;
+        }
+
+        switch (cmd[0])
+        {
+            case 's':
+            {
+                run_cycles(&dbg, arg ? atol(arg) : 1, 0);
+                break;
+            }
+
+            case 'c':
+            {
+                run_cycles(&dbg, 0, 0);
+                break;
+            }
+
+            case 'u':
+            {
+                if (arg && strcmp(arg, "stall") == 0)
+                {
+                    run_cycles(&dbg, 0, STOP_ON_STALL);
+                }
+                else if (arg && strcmp(arg, "flush") == 0)
+                {
+                    run_cycles(&dbg, 0, STOP_ON_FLUSH);
+                }
+                else
+                {
+                    printf("Usage: u stall | flush\n");
+                }
+                break;
+            }
+
+            case 'b':
+            {
+                if (!arg || dbg.num_breakpoints == MAX_BREAKPOINTS)
+                {
+                    printf("Usage: b <pc>\n");
+                    break;
+                }
+                dbg.breakpoints[dbg.num_breakpoints++] = atoi(arg);
+                break;
+            }
+
+            case 'w':
+            {
+                add_watchpoint(&dbg, arg);
+                break;
+            }
+
+            case 'd':
+            {
+                if (arg)
+                {
+                    delete_point(&dbg, atoi(arg));
+                }
+                break;
+            }
+
+            case 'i':
+            {
+                list_points(&dbg);
+                break;
+            }
+
+            case 'p':
+            {
+                print_latches(cpu, arg);
+                break;
+            }
+
+            case 'r':
+            {
+                print_registers(cpu);
+                break;
+            }
+
+            case 'm':
+            {
+                if (arg)
+                {
+                    print_memory(cpu, atoi(arg), arg2 ? atoi(arg2) : 1);
+                }
+                break;
+            }
+
+            case 'v':
+            {
+                dbg.verbose = !dbg.verbose;
+                printf("Per-cycle output %s\n", dbg.verbose ? "on" : "off");
+                break;
+            }
+
+            case 'q':
+            {
+                if (!cpu->halted)
+                {
+                    printf("APEX_CPU: Simulation Stopped, cycles = %d instructions = %d\n", cpu->clock, cpu->insn_completed);
+                }
+                return;
+            }
+
+            default:
+            {
+                print_help();
+                break;
+            }
+        }
+    }
+}
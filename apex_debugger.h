@@ -0,0 +1,16 @@
+/*
+ * apex_debugger.h
+ * Contains declarations of the cycle level interactive debugger
+ */
+#ifndef _APEX_DEBUGGER_H_
+#define _APEX_DEBUGGER_H_
+
+#include "apex_cpu.h"
+
+/*
+ * Reads commands from stdin and drives the cpu until the user quits. The cpu
+ * runs headless between stops, whatever its debug and single-step knobs say.
+ */
+void APEX_debugger_run(APEX_CPU *cpu);
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * apex_energy.c
+ * Contains the activity-based energy model. Energy is the sum over events of
+ * count times coefficient; the default coefficients are round numbers of a
+ * small in-order core and are meant to be replaced by ones for the target
+ * technology.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_energy.h"
+#include "apex_macros.h"
+
+static const char *event_names[NUM_ENERGY_EVENTS] = {
+    "fetch",     "reg_read",    "reg_write",    "alu_add",
+    "alu_logic", "alu_mul",     "alu_div",      "mem_read",
+    "mem_write", "latch_toggle", "cycle",
+};
+
+/* Picojoules per event */
+static const double default_coeff[NUM_ENERGY_EVENTS] = {
+    [ENERGY_FETCH] = 8.0,       [ENERGY_REG_READ] = 1.0,
+    [ENERGY_REG_WRITE] = 1.5,   [ENERGY_ALU_ADD] = 0.5,
+    [ENERGY_ALU_LOGIC] = 0.2,   [ENERGY_ALU_MUL] = 3.0,
+    [ENERGY_ALU_DIV] = 12.0,    [ENERGY_MEM_READ] = 10.0,
+    [ENERGY_MEM_WRITE] = 12.0,  [ENERGY_LATCH_TOGGLE] = 0.01,
+    [ENERGY_CYCLE] = 2.0,
+};
+
+#define DEFAULT_CLOCK_MHZ 1000.0
+
+/* What execute does for each opcode: the unit and how many times it is
+ * used. Memory ops add their address, LDI and STI also increment the base,
+ * branches add their target. MOVC, NOP and HALT use no unit. */
+typedef struct Execute_Event
+{
+    int event;
+    int count;
+} Execute_Event;
+
+static const Execute_Event execute_events[NUM_OPCODES] = {
+    [OPCODE_ADD] = {ENERGY_ALU_ADD, 1},   [OPCODE_SUB] = {ENERGY_ALU_ADD, 1},
+    [OPCODE_ADDL] = {ENERGY_ALU_ADD, 1},  [OPCODE_SUBL] = {ENERGY_ALU_ADD, 1},
+    [OPCODE_CMP] = {ENERGY_ALU_ADD, 1},   [OPCODE_MUL] = {ENERGY_ALU_MUL, 1},
+    [OPCODE_DIV] = {ENERGY_ALU_DIV, 1},   [OPCODE_AND] = {ENERGY_ALU_LOGIC, 1},
+    [OPCODE_OR] = {ENERGY_ALU_LOGIC, 1},  [OPCODE_XOR] = {ENERGY_ALU_LOGIC, 1},
+    [OPCODE_LOAD] = {ENERGY_ALU_ADD, 1},  [OPCODE_STORE] = {ENERGY_ALU_ADD, 1},
+    [OPCODE_LDI] = {ENERGY_ALU_ADD, 2},   [OPCODE_STI] = {ENERGY_ALU_ADD, 2},
+    [OPCODE_JUMP] = {ENERGY_ALU_ADD, 1},  [OPCODE_BZ] = {ENERGY_ALU_ADD, 1},
+    [OPCODE_BNZ] = {ENERGY_ALU_ADD, 1},   [OPCODE_BP] = {ENERGY_ALU_ADD, 1},
+    [OPCODE_BNP] = {ENERGY_ALU_ADD, 1},
+};
+
+APEX_Energy *
+APEX_energy_create(void)
+{
+    APEX_Energy *energy;
+
+    energy = calloc(1, sizeof(APEX_Energy));
+    if (!energy)
+    {
+        return NULL;
+    }
+
+    memcpy(energy->coeff, default_coeff, sizeof(default_coeff));
+    energy->clock_mhz = DEFAULT_CLOCK_MHZ;
+    return energy;
+}
+
+void
+APEX_energy_free(APEX_Energy *energy)
+{
+    free(energy);
+}
+
+int
+APEX_energy_load(APEX_Energy *energy, const char *filename)
+{
+    FILE *fp;
+    char buf[256], name[64], extra[2];
+    char *comment;
+    double value;
+    int line = 0, ret = 0, fields, i;
+
+    fp = fopen(filename, "r");
+    if (!fp)
+    {
+        fprintf(stderr, "%s: unable to open energy coefficients\n", filename);
+        return -1;
+    }
+
+    while (ret == 0 && fgets(buf, sizeof(buf), fp))
+    {
+        line++;
+        comment = strchr(buf, '#');
+        if (comment)
+        {
+            *comment = '\0';
+        }
+
+        fields = sscanf(buf, "%63s %lf %1s", name, &value, extra);
+        if (fields <= 0)
+        {
+            continue;
+        }
+        if (fields != 2 || value < 0)
+        {
+            fprintf(stderr, "%s:%d: error: expected <event> <value>\n",
+                    filename, line);
+            ret = -1;
+            break;
+        }
+
+        if (strcmp(name, "clock_mhz") == 0)
+        {
+            if (value == 0)
+            {
+                fprintf(stderr, "%s:%d: error: clock_mhz must be positive\n",
+                        filename, line);
+                ret = -1;
+            }
+            energy->clock_mhz = value;
+            continue;
+        }
+
+        for (i = 0; i < NUM_ENERGY_EVENTS; ++i)
+        {
+            if (strcmp(name, event_names[i]) == 0)
+            {
+                energy->coeff[i] = value;
+                break;
+            }
+        }
+        if (i == NUM_ENERGY_EVENTS)
+        {
+            fprintf(stderr, "%s:%d: error: unknown event '%s'\n", filename,
+                    line, name);
+            ret = -1;
+        }
+    }
+
+    fclose(fp);
+    return ret;
+}
+
+void
+APEX_energy_execute(APEX_Energy *energy, int opcode)
+{
+    const Execute_Event *ev = &execute_events[opcode];
+
+    /* Unused entries count 0 of event 0 */
+    energy->events[ev->event] += ev->count;
+}
+
+void
+APEX_energy_toggles(APEX_Energy *energy, const int *before, const int *after,
+                    int num_words)
+{
+    unsigned long toggles = 0;
+    int i;
+
+    for (i = 0; i < num_words; ++i)
+    {
+        toggles += __builtin_popcount((unsigned int)(before[i] ^ after[i]));
+    }
+
+    energy->events[ENERGY_LATCH_TOGGLE] += toggles;
+}
+
+void
+APEX_energy_print(const APEX_Energy *energy, int instructions, FILE *fp)
+{
+    double event_pj[NUM_ENERGY_EVENTS];
+    double total = 0.0;
+    unsigned long cycles = energy->events[ENERGY_CYCLE];
+    int i;
+
+    for (i = 0; i < NUM_ENERGY_EVENTS; ++i)
+    {
+        event_pj[i] = energy->events[i] * energy->coeff[i];
+        total += event_pj[i];
+    }
+
+    fprintf(fp, "APEX_CPU: Energy estimate, cycles = %lu instructions = %d\n",
+            cycles, instructions);
+    fprintf(fp, "%-14s %-12s %-10s %-14s %s\n", "event", "count", "pJ/event",
+            "energy (pJ)", "%energy");
+    for (i = 0; i < NUM_ENERGY_EVENTS; ++i)
+    {
+        fprintf(fp, "%-14s %-12lu %-10.3f %-14.1f %.2f\n", event_names[i],
+                energy->events[i], energy->coeff[i], event_pj[i],
+                total > 0 ? 100.0 * event_pj[i] / total : 0.0);
+    }
+
+    /* pJ over cycles at clock_mhz MHz comes out in microwatts */
+    fprintf(fp, "total energy: %.1f pJ\n", total);
+    fprintf(fp, "average power: %.3f mW at %.0f MHz\n",
+            cycles ? total * energy->clock_mhz / cycles / 1000.0 : 0.0,
+            energy->clock_mhz);
+    fprintf(fp, "energy per instruction: %.2f pJ\n",
+            instructions ? total / instructions : 0.0);
+}
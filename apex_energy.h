@@ -0,0 +1,56 @@
+/*
+ * apex_energy.h
+ * Contains declarations of the activity-based energy model: the pipeline
+ * counts events, and each event costs a configurable energy
+ */
+#ifndef _APEX_ENERGY_H_
+#define _APEX_ENERGY_H_
+
+#include <stdio.h>
+
+/* Events the pipeline counts */
+#define ENERGY_FETCH 0        /* Code memory read by fetch */
+#define ENERGY_REG_READ 1     /* Register file read by decode */
+#define ENERGY_REG_WRITE 2    /* Register file write by writeback */
+#define ENERGY_ALU_ADD 3      /* Adder use: arithmetic, compare, addresses */
+#define ENERGY_ALU_LOGIC 4    /* AND, OR and EX-OR */
+#define ENERGY_ALU_MUL 5
+#define ENERGY_ALU_DIV 6
+#define ENERGY_MEM_READ 7     /* Data memory read */
+#define ENERGY_MEM_WRITE 8    /* Data memory write */
+#define ENERGY_LATCH_TOGGLE 9 /* Pipeline latch bit changed at a clock edge */
+#define ENERGY_CYCLE 10       /* Clock tree and leakage of one cycle */
+#define NUM_ENERGY_EVENTS 11
+
+typedef struct APEX_Energy
+{
+    unsigned long events[NUM_ENERGY_EVENTS];
+    double coeff[NUM_ENERGY_EVENTS]; /* Picojoules per event */
+    double clock_mhz;                /* Clock the average power is for */
+} APEX_Energy;
+
+/* Creates counters with the default coefficients, or NULL */
+APEX_Energy *APEX_energy_create(void);
+void APEX_energy_free(APEX_Energy *energy);
+
+/*
+ * Reads coefficients from filename, one "<event> <picojoules>" or
+ * "clock_mhz <mhz>" per line, '#' starting a comment. Events not listed keep
+ * their value. Returns 0, or -1 and reports on stderr on failure.
+ */
+int APEX_energy_load(APEX_Energy *energy, const char *filename);
+
+/* Counts what execute does for opcode */
+void APEX_energy_execute(APEX_Energy *energy, int opcode);
+
+/* Counts the latch bits that differ between the words of before and after */
+void APEX_energy_toggles(APEX_Energy *energy, const int *before,
+                         const int *after, int num_words);
+
+/*
+ * Prints the count and energy of every event, then the total energy, the
+ * average power at clock_mhz and the energy per instruction
+ */
+void APEX_energy_print(const APEX_Energy *energy, int instructions, FILE *fp);
+
+#endif
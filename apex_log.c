@@ -0,0 +1,162 @@
+/*
+ * apex_log.c
+ * Contains the asynchronous logger. The producer and the logger thread each
+ * own one index of the ring and only publish it with a release store, so
+ * logging an event costs a few stores and no system call or lock.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "apex_log.h"
+#include "apex_macros.h"
+
+#define LOG_RING_SIZE 16384 /* Events, a power of two */
+#define LOG_IDLE_NS 50000   /* Logger sleep while the ring is empty */
+
+struct APEX_Log
+{
+    /* Producer side */
+    _Alignas(64) atomic_ulong head; /* Next event to fill */
+    unsigned long cached_tail;      /* Last tail seen, saves cache misses */
+
+    /* Logger side */
+    _Alignas(64) atomic_ulong tail; /* Next event to write out */
+    atomic_ulong flushed;           /* Events written and flushed to fp */
+    atomic_int stop;
+
+    FILE *fp;
+    pthread_t thread;
+    _Alignas(64) APEX_Log_Event ring[LOG_RING_SIZE];
+};
+
+static void *
+log_thread(void *arg)
+{
+    APEX_Log *log = arg;
+    const struct timespec idle = {0, LOG_IDLE_NS};
+    const APEX_Log_Event *event;
+    unsigned long head, tail;
+    int dirty = FALSE;
+
+    tail = atomic_load_explicit(&log->tail, memory_order_relaxed);
+
+    while (TRUE)
+    {
+        head = atomic_load_explicit(&log->head, memory_order_acquire);
+        if (tail == head)
+        {
+            /* Flush only once the producer pauses, not per batch */
+            if (dirty)
+            {
+                fflush(log->fp);
+                atomic_store_explicit(&log->flushed, tail,
+                                      memory_order_release);
+                dirty = FALSE;
+            }
+            else if (atomic_load_explicit(&log->stop, memory_order_acquire))
+            {
+                break;
+            }
+            else
+            {
+                nanosleep(&idle, NULL);
+            }
+            continue;
+        }
+
+        for (; tail != head; ++tail)
+        {
+            event = &log->ring[tail & (LOG_RING_SIZE - 1)];
+            event->format(log->fp, event);
+        }
+        atomic_store_explicit(&log->tail, tail, memory_order_release);
+        dirty = TRUE;
+    }
+
+    return NULL;
+}
+
+APEX_Log *
+APEX_log_start(FILE *fp)
+{
+    APEX_Log *log;
+
+    if (posix_memalign((void **)&log, 64, sizeof(APEX_Log)) != 0)
+    {
+        return NULL;
+    }
+
+    atomic_init(&log->head, 0);
+    atomic_init(&log->tail, 0);
+    atomic_init(&log->flushed, 0);
+    atomic_init(&log->stop, FALSE);
+    log->cached_tail = 0;
+    log->fp = fp;
+
+    if (pthread_create(&log->thread, NULL, log_thread, log) != 0)
+    {
+        free(log);
+        return NULL;
+    }
+
+    return log;
+}
+
+APEX_Log_Event *
+APEX_log_reserve(APEX_Log *log)
+{
+    unsigned long head
+        = atomic_load_explicit(&log->head, memory_order_relaxed);
+
+    while (head - log->cached_tail == LOG_RING_SIZE)
+    {
+        log->cached_tail
+            = atomic_load_explicit(&log->tail, memory_order_acquire);
+        if (head - log->cached_tail == LOG_RING_SIZE)
+        {
+            sched_yield();
+        }
+    }
+
+    return &log->ring[head & (LOG_RING_SIZE - 1)];
+}
+
+void
+APEX_log_commit(APEX_Log *log)
+{
+    unsigned long head
+        = atomic_load_explicit(&log->head, memory_order_relaxed);
+
+    atomic_store_explicit(&log->head, head + 1, memory_order_release);
+}
+
+void
+APEX_log_drain(APEX_Log *log)
+{
+    unsigned long head
+        = atomic_load_explicit(&log->head, memory_order_relaxed);
+
+    while (atomic_load_explicit(&log->flushed, memory_order_acquire) != head)
+    {
+        sched_yield();
+    }
+    log->cached_tail = head;
+}
+
+void
+APEX_log_stop(APEX_Log *log)
+{
+    if (!log)
+    {
+        return;
+    }
+
+    APEX_log_drain(log);
+    atomic_store_explicit(&log->stop, TRUE, memory_order_release);
+    pthread_join(log->thread, NULL);
+    free(log);
+}
@@ -0,0 +1,45 @@
+/*
+ * apex_log.h
+ * Contains declarations of the asynchronous logger: the simulation thread
+ * fills fixed size events in a single-producer/single-consumer lock-free
+ * ring, a background thread formats and writes them in order
+ */
+#ifndef _APEX_LOG_H_
+#define _APEX_LOG_H_
+
+#include <stdio.h>
+
+#define APEX_LOG_ARGS 10
+
+typedef struct APEX_Log APEX_Log;
+typedef struct APEX_Log_Event APEX_Log_Event;
+
+/* Formats one event, called on the logger thread */
+typedef void (*APEX_Log_Format)(FILE *fp, const APEX_Log_Event *event);
+
+/* One cache line. Strings must outlive the logger, e.g. literals or the
+ * program's mnemonic table. */
+struct APEX_Log_Event
+{
+    APEX_Log_Format format;
+    const char *str[2];
+    int arg[APEX_LOG_ARGS];
+};
+
+/* Starts the logger thread writing to fp, returns NULL on failure */
+APEX_Log *APEX_log_start(FILE *fp);
+
+/*
+ * Returns the next free event, waiting for the logger if the ring is full.
+ * The event is written out once APEX_log_commit is called.
+ */
+APEX_Log_Event *APEX_log_reserve(APEX_Log *log);
+void APEX_log_commit(APEX_Log *log);
+
+/* Waits until every committed event has been written and fp flushed */
+void APEX_log_drain(APEX_Log *log);
+
+/* Drains the ring, then stops and frees the logger */
+void APEX_log_stop(APEX_Log *log);
+
+#endif
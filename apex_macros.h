@@ -15,9 +15,33 @@
 /* Integers */
 #define DATA_MEMORY_SIZE 4096
 
-/* Size of integer register file */
+/* Default size of integer register file, see the registers knob */
 #define REG_FILE_SIZE 16
 
+/* Most registers a cpu can be configured with, one bit each in a word */
+#define MAX_REG_FILE_SIZE 64
+
+/* Most cpus APEX_cpu_step_batch steps together, 32-bit lanes of a 256-bit
+ * vector */
+#define BATCH_LANES 8
+
+/* Data memory words per L1 line of a multi-core system */
+#define L1_LINE_WORDS 4
+
+/* Longest mnemonic text kept per instruction, including the terminator */
+#define OPCODE_STR_LEN 8
+
+/* Bubble cycles lost in fetch and decode when a taken branch flushes them */
+#define BRANCH_FLUSH_PENALTY 2
+
+/* Pipeline stages, in program order */
+#define STAGE_FETCH 0
+#define STAGE_DECODE 1
+#define STAGE_EXECUTE 2
+#define STAGE_MEMORY 3
+#define STAGE_WRITEBACK 4
+#define NUM_STAGES 5
+
 /* Numeric OPCODE identifiers for instructions */
 #define OPCODE_ADD 0x0
 #define OPCODE_SUB 0x1
@@ -42,6 +66,9 @@
 #define OPCODE_BP 0xd
 #define OPCODE_BNP 0xe
 
+/* One past the largest opcode, for tables indexed by opcode */
+#define NUM_OPCODES 0x17
+
 /* Set this flag to 1 to enable debug messages */
 #define ENABLE_DEBUG_MESSAGES 1
 
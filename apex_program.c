@@ -0,0 +1,138 @@
+/*
+ * apex_program.c
+ * Contains the loaded program image. A program is parsed once, never
+ * modified afterwards and shared by reference between any number of APEX cpu
+ * instances, so memory use does not grow with the instance count.
+ */
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "apex_cpu.h"
+
+/*
+ * Assembles a regular file from a private mapping, so lines are tokenized in
+ * place without being copied. Returns 1 if the file cannot be mapped and
+ * should be streamed instead, otherwise the assembler result.
+ */
+static int
+assemble_mapped(int fd, const char *filename, APEX_Program *program)
+{
+    struct stat st;
+    long page_size = sysconf(_SC_PAGESIZE);
+    char *buffer;
+    int ret;
+
+    /* The byte after the text is written, it must fall inside the mapping */
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0
+        || page_size <= 0 || st.st_size % page_size == 0)
+    {
+        return 1;
+    }
+
+    buffer = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                  0);
+    if (buffer == MAP_FAILED)
+    {
+        return 1;
+    }
+
+    madvise(buffer, st.st_size, MADV_SEQUENTIAL);
+    ret = assemble_buffer(buffer, st.st_size, filename, program);
+    munmap(buffer, st.st_size);
+    return ret;
+}
+
+/*
+ * Assembles the input file into a program image holding one reference.
+ * A filename of "-" reads the program from stdin, so generators can pipe
+ * straight into the simulator.
+ */
+APEX_Program *
+APEX_program_load(const char *filename)
+{
+    APEX_Program *program;
+    FILE *fp;
+    int fd, ret;
+
+    program = calloc(1, sizeof(APEX_Program));
+    if (!program)
+    {
+        return NULL;
+    }
+
+    if (strcmp(filename, "-") == 0)
+    {
+        ret = assemble_program(stdin, "<stdin>", program);
+    }
+    else
+    {
+        fd = open(filename, O_RDONLY);
+        if (fd < 0)
+        {
+            free(program);
+            return NULL;
+        }
+
+        ret = assemble_mapped(fd, filename, program);
+        if (ret == 1)
+        {
+            /* Pipes, FIFOs and the like are read as a stream */
+            fp = fdopen(fd, "r");
+            if (!fp)
+            {
+                close(fd);
+                free(program);
+                return NULL;
+            }
+            ret = assemble_program(fp, filename, program);
+            fclose(fp);
+        }
+        else
+        {
+            close(fd);
+        }
+    }
+
+    if (ret != 0)
+    {
+        free(program);
+        return NULL;
+    }
+
+    atomic_init(&program->refcount, 1);
+    return program;
+}
+
+APEX_Program *
+APEX_program_retain(APEX_Program *program)
+{
+    atomic_fetch_add_explicit(&program->refcount, 1, memory_order_relaxed);
+    return program;
+}
+
+/*
+ * Drops one reference, the image is freed with the last one
+ */
+void
+APEX_program_release(APEX_Program *program)
+{
+    if (!program)
+    {
+        return;
+    }
+
+    if (atomic_fetch_sub_explicit(&program->refcount, 1, memory_order_acq_rel)
+        == 1)
+    {
+        free((APEX_Data_Word *)program->data);
+        free((APEX_Opcode_Str *)program->opcode_str);
+        free((APEX_Instruction *)program->code_memory);
+        free(program);
+    }
+}
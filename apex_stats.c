@@ -0,0 +1,399 @@
+/*
+ * apex_stats.c
+ * Contains per instruction class histograms of the cycles spent in every
+ * pipeline stage and from fetch to retirement, a time series of stage
+ * occupancy, and the live snapshots published during long runs
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "apex_macros.h"
+#include "apex_stats.h"
+
+static const char *class_names[NUM_CLASSES]
+    = {"ALU", "LOAD", "STORE", "BRANCH", "OTHER"};
+
+static const char *stage_names[NUM_STAGES]
+    = {"fetch", "decode", "execute", "memory", "writeback"};
+
+static int
+opcode_class(int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_LOAD:
+        case OPCODE_LDI:
+        {
+            return CLASS_LOAD;
+        }
+
+        case OPCODE_STORE:
+        case OPCODE_STI:
+        {
+            return CLASS_STORE;
+        }
+
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        case OPCODE_BP:
+        case OPCODE_BNP:
+        case OPCODE_JUMP:
+        {
+            return CLASS_BRANCH;
+        }
+
+        case OPCODE_NOP:
+        case OPCODE_HALT:
+        {
+            return CLASS_OTHER;
+        }
+    }
+
+    return CLASS_ALU;
+}
+
+static int
+latency_bucket(int cycles)
+{
+    int bucket = 8;
+
+    if (cycles < 8)
+    {
+        return cycles < 0 ? 0 : cycles;
+    }
+
+    while (bucket < LATENCY_BUCKETS - 1 && cycles >= (16 << (bucket - 8)))
+    {
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/* Lowest value counted in a bucket */
+static int
+bucket_low(int bucket)
+{
+    return bucket < 8 ? bucket : 8 << (bucket - 8);
+}
+
+APEX_Latency_Stats *
+APEX_latency_create(int interval)
+{
+    APEX_Latency_Stats *stats;
+
+    stats = calloc(1, sizeof(APEX_Latency_Stats));
+    if (!stats)
+    {
+        return NULL;
+    }
+
+    stats->interval = interval > 0 ? interval : 1000;
+    return stats;
+}
+
+void
+APEX_latency_free(APEX_Latency_Stats *stats)
+{
+    if (stats)
+    {
+        free(stats->rows);
+        free(stats);
+    }
+}
+
+void
+APEX_latency_retire(APEX_Latency_Stats *stats, int opcode,
+                    const int enter_cycle[NUM_STAGES], int retire_cycle)
+{
+    int cls = opcode_class(opcode);
+    int i, cycles, leave;
+
+    stats->retired[cls]++;
+
+    for (i = 0; i < NUM_STAGES; ++i)
+    {
+        /* A stage is left when the next one is entered */
+        leave = (i + 1 < NUM_STAGES) ? enter_cycle[i + 1] : retire_cycle + 1;
+        cycles = leave - enter_cycle[i];
+        stats->stage_cycles[cls][i] += cycles;
+        stats->stage_hist[cls][i][latency_bucket(cycles)]++;
+    }
+
+    cycles = retire_cycle + 1 - enter_cycle[STAGE_FETCH];
+    stats->total_cycles[cls] += cycles;
+    stats->total_hist[cls][latency_bucket(cycles)]++;
+    if (cycles > stats->max_latency[cls])
+    {
+        stats->max_latency[cls] = cycles;
+    }
+}
+
+void
+APEX_latency_sample(APEX_Latency_Stats *stats, int cycle,
+                    const int busy[NUM_STAGES])
+{
+    APEX_Occupancy_Row *row, *rows;
+    int i, capacity;
+
+    row = stats->num_rows ? &stats->rows[stats->num_rows - 1] : NULL;
+    if (!row || row->cycles == stats->interval)
+    {
+        if (stats->num_rows == stats->rows_capacity)
+        {
+            capacity = stats->rows_capacity ? 2 * stats->rows_capacity : 256;
+            rows = realloc(stats->rows, capacity * sizeof(APEX_Occupancy_Row));
+            if (!rows)
+            {
+                return;
+            }
+            stats->rows = rows;
+            stats->rows_capacity = capacity;
+        }
+
+        row = &stats->rows[stats->num_rows++];
+        memset(row, 0, sizeof(APEX_Occupancy_Row));
+        row->first_cycle = cycle;
+    }
+
+    row->cycles++;
+    for (i = 0; i < NUM_STAGES; ++i)
+    {
+        row->busy[i] += busy[i] ? 1 : 0;
+    }
+}
+
+static void
+print_class(const APEX_Latency_Stats *stats, int cls, FILE *fp)
+{
+    char label[32];
+    unsigned long any;
+    int b, i, low;
+
+    fprintf(fp, "\n%s: %lu retired, mean latency %.2f, max %d cycles\n",
+            class_names[cls], stats->retired[cls],
+            (double)stats->total_cycles[cls] / stats->retired[cls],
+            stats->max_latency[cls]);
+
+    fprintf(fp, "  %-10s", "cycles");
+    for (i = 0; i < NUM_STAGES; ++i)
+    {
+        fprintf(fp, " %10s", stage_names[i]);
+    }
+    fprintf(fp, " %10s\n", "latency");
+
+    fprintf(fp, "  %-10s", "mean");
+    for (i = 0; i < NUM_STAGES; ++i)
+    {
+        fprintf(fp, " %10.2f",
+                (double)stats->stage_cycles[cls][i] / stats->retired[cls]);
+    }
+    fprintf(fp, " %10.2f\n",
+            (double)stats->total_cycles[cls] / stats->retired[cls]);
+
+    for (b = 0; b < LATENCY_BUCKETS; ++b)
+    {
+        any = stats->total_hist[cls][b];
+        for (i = 0; i < NUM_STAGES; ++i)
+        {
+            any |= stats->stage_hist[cls][i][b];
+        }
+        if (!any)
+        {
+            continue;
+        }
+
+        low = bucket_low(b);
+        if (b < 8)
+        {
+            snprintf(label, sizeof(label), "%d", low);
+        }
+        else if (b < LATENCY_BUCKETS - 1)
+        {
+            snprintf(label, sizeof(label), "%d-%d", low, 2 * low - 1);
+        }
+        else
+        {
+            snprintf(label, sizeof(label), "%d+", low);
+        }
+
+        fprintf(fp, "  %-10s", label);
+        for (i = 0; i < NUM_STAGES; ++i)
+        {
+            fprintf(fp, " %10lu", stats->stage_hist[cls][i][b]);
+        }
+        fprintf(fp, " %10lu\n", stats->total_hist[cls][b]);
+    }
+}
+
+/*
+ * Prints the per class histograms, then the occupancy time series as the
+ * percentage of cycles in each interval a stage held an instruction
+ */
+void
+APEX_latency_print(const APEX_Latency_Stats *stats, FILE *fp)
+{
+    const APEX_Occupancy_Row *row;
+    int cls, i, r;
+
+    fprintf(fp, "APEX_CPU: Cycles spent per stage and from fetch to "
+                "retirement, by instruction class\n");
+
+    for (cls = 0; cls < NUM_CLASSES; ++cls)
+    {
+        if (stats->retired[cls])
+        {
+            print_class(stats, cls, fp);
+        }
+    }
+
+    fprintf(fp, "\nStage occupancy (%%) every %d cycles\n", stats->interval);
+    fprintf(fp, "  %-10s", "cycle");
+    for (i = 0; i < NUM_STAGES; ++i)
+    {
+        fprintf(fp, " %10s", stage_names[i]);
+    }
+    fprintf(fp, "\n");
+
+    for (r = 0; r < stats->num_rows; ++r)
+    {
+        row = &stats->rows[r];
+        fprintf(fp, "  %-10d", row->first_cycle);
+        for (i = 0; i < NUM_STAGES; ++i)
+        {
+            fprintf(fp, " %10.1f", 100.0 * row->busy[i] / row->cycles);
+        }
+        fprintf(fp, "\n");
+    }
+}
+
+APEX_Snapshot *
+APEX_snapshot_open(const char *target, int interval)
+{
+    APEX_Snapshot *snap;
+    const char *path;
+
+    snap = calloc(1, sizeof(APEX_Snapshot));
+    if (!snap)
+    {
+        return NULL;
+    }
+
+    snap->interval = interval > 0 ? interval : 1;
+    snap->next_cycle = snap->interval;
+
+    if (strncmp(target, "unix:", 5) == 0)
+    {
+        /* Datagrams are sent unconnected, so the reader may come and go */
+        path = target + 5;
+        snap->is_socket = TRUE;
+        snap->socket_path = strdup(path);
+        snap->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+        if (!snap->socket_path || snap->fd < 0
+            || strlen(path) >= sizeof(((struct sockaddr_un *)0)->sun_path))
+        {
+            fprintf(stderr, "%s: unable to create snapshot socket\n", path);
+            APEX_snapshot_close(snap);
+            return NULL;
+        }
+    }
+    else if (strcmp(target, "-") == 0)
+    {
+        snap->fd = STDOUT_FILENO;
+    }
+    else
+    {
+        snap->fd = open(target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (snap->fd < 0)
+        {
+            fprintf(stderr, "%s: unable to open snapshot file\n", target);
+            free(snap);
+            return NULL;
+        }
+    }
+
+    return snap;
+}
+
+/* Writes a whole line with one system call, a socket reader that is not
+ * there or not keeping up loses the line instead of stalling the run */
+static void
+publish_line(APEX_Snapshot *snap, const char *line, size_t len)
+{
+    struct sockaddr_un addr;
+    ssize_t ret;
+
+    if (!snap->is_socket)
+    {
+        /* Keep the line in order with buffered per-cycle output */
+        if (snap->fd == STDOUT_FILENO)
+        {
+            fflush(stdout);
+        }
+
+        do
+        {
+            ret = write(snap->fd, line, len);
+        } while (ret < 0 && errno == EINTR);
+        return;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, snap->socket_path);
+    if (sendto(snap->fd, line, len, MSG_DONTWAIT | MSG_NOSIGNAL,
+               (struct sockaddr *)&addr, sizeof(addr))
+        < 0)
+    {
+        snap->dropped++;
+    }
+}
+
+void
+APEX_snapshot_publish(APEX_Snapshot *snap, int cycle, unsigned long retired,
+                      unsigned long stalls, unsigned long flushes,
+                      unsigned long memory_ops)
+{
+    char line[256];
+    int cycles = cycle - snap->last_cycle;
+    int len;
+
+    len = snprintf(line, sizeof(line),
+                   "cycle=%d instructions=%lu interval_cycles=%d ipc=%.3f "
+                   "stalls=%lu flushes=%lu memory_ops=%lu dropped=%lu\n",
+                   cycle, retired, cycles,
+                   cycles ? (double)(retired - snap->last_retired) / cycles
+                          : 0.0,
+                   stalls - snap->last_stalls, flushes - snap->last_flushes,
+                   memory_ops - snap->last_memory_ops, snap->dropped);
+    publish_line(snap, line, len);
+
+    snap->last_cycle = cycle;
+    snap->last_retired = retired;
+    snap->last_stalls = stalls;
+    snap->last_flushes = flushes;
+    snap->last_memory_ops = memory_ops;
+    snap->next_cycle = cycle + snap->interval;
+}
+
+void
+APEX_snapshot_close(APEX_Snapshot *snap)
+{
+    if (!snap)
+    {
+        return;
+    }
+
+    if (snap->fd >= 0 && snap->fd != STDOUT_FILENO)
+    {
+        close(snap->fd);
+    }
+    free(snap->socket_path);
+    free(snap);
+}
@@ -0,0 +1,92 @@
+/*
+ * apex_stats.h
+ * Contains declarations of the pipeline latency and occupancy statistics
+ */
+#ifndef _APEX_STATS_H_
+#define _APEX_STATS_H_
+
+#include <stdio.h>
+
+#include "apex_macros.h"
+
+/* Instruction classes the statistics are broken down by */
+#define CLASS_ALU 0
+#define CLASS_LOAD 1
+#define CLASS_STORE 2
+#define CLASS_BRANCH 3
+#define CLASS_OTHER 4
+#define NUM_CLASSES 5
+
+/* Buckets 0-7 count single cycle values, the rest double in width */
+#define LATENCY_BUCKETS 16
+
+/* Fraction of cycles each stage held an instruction over one interval */
+typedef struct APEX_Occupancy_Row
+{
+    int first_cycle;
+    int cycles;
+    unsigned long busy[NUM_STAGES];
+} APEX_Occupancy_Row;
+
+typedef struct APEX_Latency_Stats
+{
+    unsigned long retired[NUM_CLASSES];
+    unsigned long stage_cycles[NUM_CLASSES][NUM_STAGES];
+    unsigned long total_cycles[NUM_CLASSES];
+    unsigned long stage_hist[NUM_CLASSES][NUM_STAGES][LATENCY_BUCKETS];
+    unsigned long total_hist[NUM_CLASSES][LATENCY_BUCKETS];
+    int max_latency[NUM_CLASSES];
+
+    int interval;              /* Cycles per occupancy row */
+    APEX_Occupancy_Row *rows;  /* Completed rows, then the current one */
+    int num_rows;
+    int rows_capacity;
+} APEX_Latency_Stats;
+
+APEX_Latency_Stats *APEX_latency_create(int interval);
+void APEX_latency_free(APEX_Latency_Stats *stats);
+
+/*
+ * Accounts a retiring instruction from the cycles it entered each stage,
+ * retire_cycle being the cycle it spends in writeback
+ */
+void APEX_latency_retire(APEX_Latency_Stats *stats, int opcode,
+                         const int enter_cycle[NUM_STAGES], int retire_cycle);
+
+/* Samples which stages hold an instruction at the start of cycle */
+void APEX_latency_sample(APEX_Latency_Stats *stats, int cycle,
+                         const int busy[NUM_STAGES]);
+
+void APEX_latency_print(const APEX_Latency_Stats *stats, FILE *fp);
+
+/* Periodic statistics published while a long run is in progress */
+typedef struct APEX_Snapshot
+{
+    int fd;
+    int is_socket;
+    char *socket_path;
+    int interval; /* Cycles between snapshots */
+    int next_cycle;
+    int last_cycle;
+    unsigned long last_retired;
+    unsigned long last_stalls;
+    unsigned long last_flushes;
+    unsigned long last_memory_ops;
+    unsigned long dropped; /* Snapshots no reader took */
+} APEX_Snapshot;
+
+/*
+ * Opens the snapshot target: "unix:<path>" sends one datagram per snapshot to
+ * a UNIX socket bound at path, "-" writes to stdout and anything else is a
+ * file that can be tailed. Returns NULL and reports on stderr on failure.
+ */
+APEX_Snapshot *APEX_snapshot_open(const char *target, int interval);
+
+/* Publishes one line with the totals and rates since the last snapshot */
+void APEX_snapshot_publish(APEX_Snapshot *snap, int cycle,
+                           unsigned long retired, unsigned long stalls,
+                           unsigned long flushes, unsigned long memory_ops);
+
+void APEX_snapshot_close(APEX_Snapshot *snap);
+
+#endif
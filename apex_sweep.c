@@ -0,0 +1,562 @@
+/*
+ * apex_sweep.c
+ * Contains the parameter sweep driver, which runs a grid of APEX cpu
+ * configurations on a pool of host threads with work stealing, each thread
+ * stepping a batch of points in lock-step
+ */
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+#include "apex_sweep.h"
+
+/* Cycles a point may go without retiring an instruction before it is
+ * stopped as deadlocked, so one stuck point cannot hold up the sweep */
+#define SWEEP_DEADLOCK_CYCLES 10000
+
+/* One dimension of the grid */
+typedef struct Sweep_Axis
+{
+    char key[32];
+    int num_values;
+    long *values;
+} Sweep_Axis;
+
+/* Outcome of one grid point */
+typedef struct Sweep_Result
+{
+    int cycles;
+    int instructions;
+    int halted;
+    int deadlocked;
+    int failed;
+} Sweep_Result;
+
+/*
+ * Per-worker deque of grid point indices. The owner pops from the tail and
+ * idle workers steal from the head; one lock per deque is plenty since every
+ * point runs a whole simulation.
+ */
+typedef struct Sweep_Deque
+{
+    pthread_mutex_t lock;
+    int *points;
+    int head;
+    int tail;
+} Sweep_Deque;
+
+typedef struct Sweep_State
+{
+    APEX_Program *program;
+    const APEX_Config *base;
+    const Sweep_Axis *axes;
+    int num_axes;
+    int num_workers;
+    Sweep_Deque *deques;
+    Sweep_Result *results;
+} Sweep_State;
+
+typedef struct Sweep_Worker
+{
+    Sweep_State *state;
+    int id;
+} Sweep_Worker;
+
+static int
+parse_axis(Sweep_Axis *axis, const char *spec)
+{
+    const char *eq = strchr(spec, '=');
+    const char *p;
+    char *end;
+    long first, last, step;
+    unsigned long count;
+    int n;
+
+    if (!eq || eq == spec || (size_t)(eq - spec) >= sizeof(axis->key))
+    {
+        return -1;
+    }
+
+    memcpy(axis->key, spec, eq - spec);
+    axis->key[eq - spec] = '\0';
+    p = eq + 1;
+
+    if (strchr(p, ':'))
+    {
+        /* Range form first:last[:step] */
+        first = strtol(p, &end, 10);
+        if (end == p || *end != ':')
+        {
+            return -1;
+        }
+        p = end + 1;
+        last = strtol(p, &end, 10);
+        if (end == p || (*end != ':' && *end != '\0'))
+        {
+            return -1;
+        }
+        step = 1;
+        if (*end == ':')
+        {
+            p = end + 1;
+            step = strtol(p, &end, 10);
+            if (end == p || *end != '\0' || step <= 0)
+            {
+                return -1;
+            }
+        }
+        if (last < first)
+        {
+            return -1;
+        }
+
+        /* In unsigned arithmetic, the span of a long range may not fit */
+        count = ((unsigned long)last - (unsigned long)first) / step + 1;
+        if (count > INT_MAX)
+        {
+            return -1;
+        }
+
+        axis->num_values = (int)count;
+        axis->values = calloc(axis->num_values, sizeof(long));
+        if (!axis->values)
+        {
+            return -1;
+        }
+        for (n = 0; n < axis->num_values; ++n)
+        {
+            axis->values[n] = first + n * step;
+        }
+        return 0;
+    }
+
+    /* List form v1,v2,... */
+    axis->num_values = 1;
+    for (end = (char *)p; *end; ++end)
+    {
+        if (*end == ',')
+        {
+            axis->num_values++;
+        }
+    }
+
+    axis->values = calloc(axis->num_values, sizeof(long));
+    if (!axis->values)
+    {
+        return -1;
+    }
+
+    for (n = 0; n < axis->num_values; ++n)
+    {
+        axis->values[n] = strtol(p, &end, 10);
+        if (end == p || (*end != ',' && *end != '\0'))
+        {
+            return -1;
+        }
+        p = end + 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Value of one axis at a grid point, the last axis varies fastest
+ */
+static long
+point_coordinate(const Sweep_State *state, int point, int axis)
+{
+    int i;
+
+    for (i = state->num_axes - 1; i > axis; --i)
+    {
+        point /= state->axes[i].num_values;
+    }
+
+    return state->axes[axis].values[point % state->axes[axis].num_values];
+}
+
+static int
+make_point_config(const Sweep_State *state, int point, APEX_Config *config)
+{
+    int i;
+    char value[24];
+
+    *config = *state->base;
+    config->debug_messages = FALSE;
+    config->single_step = FALSE;
+    config->quiet = TRUE;
+
+    for (i = 0; i < state->num_axes; ++i)
+    {
+        snprintf(value, sizeof(value), "%ld",
+                 point_coordinate(state, point, i));
+
+        if (APEX_config_set(config, state->axes[i].key, value) != 0)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Creates the cpu of a grid point, or returns NULL with the point failed */
+static APEX_CPU *
+start_point(Sweep_State *state, int point)
+{
+    APEX_CPU *cpu;
+    APEX_Config config;
+
+    if (make_point_config(state, point, &config) != 0)
+    {
+        state->results[point].failed = TRUE;
+        return NULL;
+    }
+
+    cpu = APEX_cpu_create(state->program, &config);
+    if (!cpu)
+    {
+        state->results[point].failed = TRUE;
+    }
+    return cpu;
+}
+
+static void
+finish_point(Sweep_State *state, int point, APEX_CPU *cpu, int deadlocked)
+{
+    Sweep_Result *result = &state->results[point];
+
+    result->halted = cpu->halted;
+    result->deadlocked = deadlocked;
+    result->cycles = cpu->clock;
+    result->instructions = cpu->insn_completed;
+    APEX_cpu_stop(cpu);
+}
+
+static int
+pop_own(Sweep_Deque *dq, int *point)
+{
+    int found = FALSE;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail)
+    {
+        *point = dq->points[--dq->tail];
+        found = TRUE;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+static int
+steal(Sweep_Deque *dq, int *point)
+{
+    int found = FALSE;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail)
+    {
+        *point = dq->points[dq->head++];
+        found = TRUE;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+/* Next point for worker id, its own or stolen. No new work is ever created,
+ * so one empty round means there is none left. */
+static int
+next_point(Sweep_State *state, int id, int *point)
+{
+    int i;
+
+    if (pop_own(&state->deques[id], point))
+    {
+        return TRUE;
+    }
+
+    for (i = 1; i < state->num_workers; ++i)
+    {
+        if (steal(&state->deques[(id + i) % state->num_workers], point))
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/*
+ * Runs points BATCH_LANES at a time through APEX_cpu_step_batch, refilling a
+ * lane as soon as its point halts, runs out of cycles or retires nothing for
+ * SWEEP_DEADLOCK_CYCLES. The lanes do not interact, so results are those of
+ * running every point on its own.
+ */
+static void *
+sweep_worker(void *arg)
+{
+    Sweep_Worker *worker = arg;
+    Sweep_State *state = worker->state;
+    APEX_CPU *cpus[BATCH_LANES];
+    int points[BATCH_LANES];
+    int halted[BATCH_LANES];
+    int retired[BATCH_LANES];  /* Instructions at the last retirement */
+    int progress[BATCH_LANES]; /* Cycle of the last retirement */
+    APEX_CPU *cpu;
+    int point, lane, deadlocked, num_lanes = 0;
+
+    while (TRUE)
+    {
+        while (num_lanes < BATCH_LANES
+               && next_point(state, worker->id, &point))
+        {
+            cpu = start_point(state, point);
+            if (cpu)
+            {
+                cpus[num_lanes] = cpu;
+                retired[num_lanes] = cpu->insn_completed;
+                progress[num_lanes] = cpu->clock;
+                points[num_lanes++] = point;
+            }
+        }
+
+        if (num_lanes == 0)
+        {
+            return NULL;
+        }
+
+        APEX_cpu_step_batch(cpus, num_lanes, halted);
+
+        /* Same stopping rules as APEX_cpu_run, the last lane moves into
+         * the place of a finished one */
+        for (lane = num_lanes - 1; lane >= 0; --lane)
+        {
+            cpu = cpus[lane];
+            if (cpu->insn_completed != retired[lane])
+            {
+                retired[lane] = cpu->insn_completed;
+                progress[lane] = cpu->clock;
+            }
+            deadlocked = cpu->clock - progress[lane] >= SWEEP_DEADLOCK_CYCLES;
+
+            if (halted[lane] || deadlocked
+                || (cpu->config.max_cycles
+                    && cpu->clock >= cpu->config.max_cycles))
+            {
+                finish_point(state, points[lane], cpu, deadlocked);
+                num_lanes--;
+                cpus[lane] = cpus[num_lanes];
+                points[lane] = points[num_lanes];
+                retired[lane] = retired[num_lanes];
+                progress[lane] = progress[num_lanes];
+            }
+        }
+    }
+}
+
+static void
+write_csv(const Sweep_State *state, int num_points, FILE *csv)
+{
+    int i, point;
+    const Sweep_Result *result;
+
+    fprintf(csv, "point");
+    for (i = 0; i < state->num_axes; ++i)
+    {
+        fprintf(csv, ",%s", state->axes[i].key);
+    }
+    fprintf(csv, ",cycles,instructions,ipc,halted\n");
+
+    for (point = 0; point < num_points; ++point)
+    {
+        result = &state->results[point];
+        fprintf(csv, "%d", point);
+        for (i = 0; i < state->num_axes; ++i)
+        {
+            fprintf(csv, ",%ld", point_coordinate(state, point, i));
+        }
+
+        if (result->failed)
+        {
+            fprintf(csv, ",,,,error\n");
+            continue;
+        }
+
+        fprintf(csv, ",%d,%d,%.4f,", result->cycles, result->instructions,
+                result->cycles ? (double)result->instructions / result->cycles
+                               : 0.0);
+        if (result->deadlocked)
+        {
+            fprintf(csv, "deadlock\n");
+        }
+        else
+        {
+            fprintf(csv, "%d\n", result->halted);
+        }
+    }
+}
+
+int
+APEX_sweep_run(APEX_Program *program, const APEX_Config *base, char *const *axes, int num_axes,
+               int num_threads, FILE *csv)
+{
+    Sweep_State state;
+    Sweep_Axis *parsed;
+    Sweep_Worker *workers = NULL;
+    pthread_t *threads = NULL;
+    APEX_Config scratch;
+    char value[24];
+    int i, w, num_points = 1, started = 0, ret = -1;
+
+    memset(&state, 0, sizeof(state));
+    parsed = calloc(num_axes > 0 ? num_axes : 1, sizeof(Sweep_Axis));
+    if (!parsed)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < num_axes; ++i)
+    {
+        if (parse_axis(&parsed[i], axes[i]) != 0)
+        {
+            fprintf(stderr, "APEX_Error: Invalid sweep axis '%s'\n", axes[i]);
+            goto out;
+        }
+
+        /* Points are counted in an int, and each has a result */
+        if (parsed[i].num_values > INT_MAX / num_points
+            || (size_t)num_points * parsed[i].num_values
+                   > SIZE_MAX / sizeof(Sweep_Result))
+        {
+            fprintf(stderr, "APEX_Error: Sweep grid has more than %d points\n",
+                    INT_MAX);
+            goto out;
+        }
+        num_points *= parsed[i].num_values;
+    }
+
+    state.program = program;
+    state.base = base;
+    state.axes = parsed;
+    state.num_axes = num_axes;
+
+    /* Reject unknown keys and bad values up front rather than per point */
+    for (i = 0; i < num_axes; ++i)
+    {
+        scratch = *base;
+        if (APEX_config_set(&scratch, parsed[i].key, "0") != 0)
+        {
+            fprintf(stderr, "APEX_Error: Unknown sweep key '%s'\n",
+                    parsed[i].key);
+            goto out;
+        }
+        if (!APEX_config_sweepable(parsed[i].key))
+        {
+            fprintf(stderr, "APEX_Error: '%s' cannot be a sweep axis\n",
+                    parsed[i].key);
+            goto out;
+        }
+        for (w = 0; w < parsed[i].num_values; ++w)
+        {
+            snprintf(value, sizeof(value), "%ld", parsed[i].values[w]);
+            if (APEX_config_set(&scratch, parsed[i].key, value) != 0)
+            {
+                fprintf(stderr, "APEX_Error: Invalid value %s for sweep key "
+                                "'%s'\n", value, parsed[i].key);
+                goto out;
+            }
+        }
+    }
+
+    if (num_threads <= 0)
+    {
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_threads <= 0)
+    {
+        num_threads = 1;
+    }
+    if (num_threads > num_points)
+    {
+        num_threads = num_points;
+    }
+    state.num_workers = num_threads;
+
+    state.results = calloc(num_points, sizeof(Sweep_Result));
+    state.deques = calloc(num_threads, sizeof(Sweep_Deque));
+    workers = calloc(num_threads, sizeof(Sweep_Worker));
+    threads = calloc(num_threads, sizeof(pthread_t));
+    if (!state.results || !state.deques || !workers || !threads)
+    {
+        goto out;
+    }
+
+    /* Deal contiguous blocks of points to the workers */
+    for (w = 0; w < num_threads; ++w)
+    {
+        int first = (int)((long)num_points * w / num_threads);
+        int last = (int)((long)num_points * (w + 1) / num_threads);
+
+        pthread_mutex_init(&state.deques[w].lock, NULL);
+        state.deques[w].points = calloc(last - first + 1, sizeof(int));
+        if (!state.deques[w].points)
+        {
+            goto out;
+        }
+        /* Owner pops from the tail, so store the block in reverse */
+        for (i = first; i < last; ++i)
+        {
+            state.deques[w].points[last - 1 - i] = i;
+        }
+        state.deques[w].tail = last - first;
+        workers[w].state = &state;
+        workers[w].id = w;
+    }
+
+    for (w = 0; w < num_threads; ++w)
+    {
+        if (pthread_create(&threads[w], NULL, sweep_worker, &workers[w]) != 0)
+        {
+            break;
+        }
+        started++;
+    }
+
+    /* Whatever could not be started is stolen by the running workers */
+    if (started == 0)
+    {
+        sweep_worker(&workers[0]);
+    }
+    for (w = 0; w < started; ++w)
+    {
+        pthread_join(threads[w], NULL);
+    }
+
+    write_csv(&state, num_points, csv);
+    ret = 0;
+
+out:
+    if (state.deques)
+    {
+        for (w = 0; w < state.num_workers; ++w)
+        {
+            free(state.deques[w].points);
+        }
+    }
+    free(state.deques);
+    free(state.results);
+    free(workers);
+    free(threads);
+    for (i = 0; i < num_axes; ++i)
+    {
+        free(parsed[i].values);
+    }
+    free(parsed);
+    return ret;
+}
@@ -0,0 +1,22 @@
+/*
+ * apex_sweep.h
+ * Contains declarations of the parallel parameter sweep driver
+ */
+#ifndef _APEX_SWEEP_H_
+#define _APEX_SWEEP_H_
+
+#include <stdio.h>
+
+#include "apex_cpu.h"
+
+/*
+ * Runs one headless APEX cpu per point of the grid described by axes, each
+ * "key=v1,v2,..." or "key=first:last[:step]" with keys from APEX_config_set,
+ * on num_threads host threads (0 for one per online core). All points share
+ * the given program image. Results are written to csv in grid order, so the
+ * output does not depend on scheduling. Returns 0 on success.
+ */
+int APEX_sweep_run(APEX_Program *program, const APEX_Config *base,
+                   char *const *axes, int num_axes, int num_threads, FILE *csv);
+
+#endif
@@ -0,0 +1,609 @@
+/*
+ * apex_system.c
+ * Contains the multi-core system. Every cycle has two phases: each core
+ * steps on its own, completing L1 hits and posting misses, then the
+ * interconnect grants the posted requests one at a time, snooping the other
+ * L1s and scheduling each transaction on the bus.
+ *
+ * Hits only touch lines the core holds, shared for loads and modified for
+ * stores, so no two cores can race on a word during the core phase. The
+ * core phase can therefore be split over host threads, with a barrier on
+ * either side of the interconnect phase, and give the same results as the
+ * serial loop.
+ */
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "apex_arena.h"
+#include "apex_cpu.h"
+#include "apex_macros.h"
+#include "apex_system.h"
+
+static APEX_L1_Line *
+l1_line(const APEX_System *system, const APEX_Core *core, unsigned int tag)
+{
+    return &core->l1[tag % (unsigned int)system->config.l1_lines];
+}
+
+static unsigned int
+line_tag(int address)
+{
+    return (unsigned int)address / L1_LINE_WORDS;
+}
+
+/* Whether the L1 of core holds the line of the access in stage, shared for
+ * a load and modified for a store */
+static int
+l1_hit(const APEX_System *system, const APEX_Core *core,
+       const CPU_Stage *stage, int is_store)
+{
+    unsigned int tag = line_tag(stage->memory_address);
+    const APEX_L1_Line *line = l1_line(system, core, tag);
+
+    return line->tag == tag
+           && (is_store ? line->state == LINE_MODIFIED
+                        : line->state != LINE_INVALID);
+}
+
+static int
+is_store_op(int opcode)
+{
+    return opcode == OPCODE_STORE || opcode == OPCODE_STI;
+}
+
+int
+APEX_system_ready(const APEX_System *system, int core_id,
+                  const CPU_Stage *stage, int cycle)
+{
+    const APEX_Core *core = &system->cores[core_id];
+    const APEX_Bus_Request *req = &core->request;
+
+    if (req->granted)
+    {
+        return cycle >= req->done_cycle;
+    }
+
+    return !req->pending
+           && l1_hit(system, core, stage, is_store_op(stage->opcode));
+}
+
+int
+APEX_system_access(APEX_System *system, int core_id, CPU_Stage *stage,
+                   int cycle)
+{
+    APEX_Core *core = &system->cores[core_id];
+    APEX_Bus_Request *req = &core->request;
+    int is_store;
+
+    if (req->granted)
+    {
+        if (cycle < req->done_cycle)
+        {
+            return FALSE;
+        }
+
+        if (!req->is_store)
+        {
+            stage->result_buffer = req->value;
+        }
+        req->granted = FALSE;
+        return TRUE;
+    }
+
+    if (req->pending)
+    {
+        return FALSE;
+    }
+
+    is_store = is_store_op(stage->opcode);
+
+    if (is_store)
+    {
+        core->stats.stores++;
+    }
+    else
+    {
+        core->stats.loads++;
+    }
+
+    if (l1_hit(system, core, stage, is_store))
+    {
+        core->stats.hits++;
+        if (is_store)
+        {
+            system->memory[stage->memory_address] = stage->rs1_value;
+        }
+        else
+        {
+            stage->result_buffer = system->memory[stage->memory_address];
+        }
+        return TRUE;
+    }
+
+    req->pending = TRUE;
+    req->is_store = is_store;
+    req->address = stage->memory_address;
+    req->value = stage->rs1_value;
+    return FALSE;
+}
+
+/*
+ * Puts the request of core on the bus: a read takes modified copies down to
+ * shared, a write invalidates every other copy. Memory supplies the line
+ * unless another cache held it modified or the core is only upgrading.
+ */
+static void
+grant(APEX_System *system, int core_id)
+{
+    APEX_Core *core = &system->cores[core_id];
+    APEX_Bus_Request *req = &core->request;
+    unsigned int tag = line_tag(req->address);
+    APEX_L1_Line *own = l1_line(system, core, tag);
+    APEX_L1_Line *other;
+    int supplied = FALSE;
+    int upgrade, latency, start, i;
+
+    for (i = 0; i < system->num_cores; ++i)
+    {
+        other = l1_line(system, &system->cores[i], tag);
+        if (i == core_id || other->tag != tag || other->state == LINE_INVALID)
+        {
+            continue;
+        }
+
+        if (other->state == LINE_MODIFIED)
+        {
+            supplied = TRUE;
+            system->interventions++;
+        }
+
+        if (req->is_store)
+        {
+            other->state = LINE_INVALID;
+            system->cores[i].stats.invalidated++;
+        }
+        else
+        {
+            other->state = LINE_SHARED;
+        }
+    }
+
+    upgrade = req->is_store && own->tag == tag && own->state == LINE_SHARED;
+    if (upgrade)
+    {
+        core->stats.upgrades++;
+    }
+    else
+    {
+        core->stats.misses++;
+        if (own->state == LINE_MODIFIED)
+        {
+            system->dirty_evictions++;
+        }
+    }
+
+    own->tag = tag;
+    own->state = req->is_store ? LINE_MODIFIED : LINE_SHARED;
+
+    /* The bus carries one transaction at a time */
+    latency = system->config.bus_latency;
+    if (!upgrade && !supplied)
+    {
+        latency += system->config.memory_latency;
+    }
+    start = system->cycle + 1;
+    if (start < system->bus_free_cycle)
+    {
+        core->stats.bus_wait_cycles += system->bus_free_cycle - start;
+        start = system->bus_free_cycle;
+    }
+    req->done_cycle = start + latency - 1;
+    system->bus_free_cycle = req->done_cycle + 1;
+    system->bus_transactions++;
+
+    /* Memory is always current, the transaction takes effect in bus order */
+    if (req->is_store)
+    {
+        system->memory[req->address] = req->value;
+    }
+    else
+    {
+        req->value = system->memory[req->address];
+    }
+
+    req->pending = FALSE;
+    req->granted = TRUE;
+}
+
+/* Grants the requests posted this cycle, round robin from cycle % cores */
+static void
+interconnect(APEX_System *system)
+{
+    int i, core_id;
+
+    for (i = 0; i < system->num_cores; ++i)
+    {
+        core_id = (system->cycle + i) % system->num_cores;
+        if (system->cores[core_id].request.pending)
+        {
+            grant(system, core_id);
+        }
+    }
+}
+
+/* Core phase for the cores first, first + stride, ... */
+static void
+step_cores(APEX_System *system, int first, int stride)
+{
+    APEX_CPU *cpu;
+    int i;
+
+    for (i = first; i < system->num_cores; i += stride)
+    {
+        cpu = system->cores[i].cpu;
+        if (!cpu->halted)
+        {
+            APEX_cpu_step(cpu);
+        }
+    }
+}
+
+/*
+ * Interconnect phase and end of cycle, returns TRUE when the run is over,
+ * with system->halted set if every core retired HALT
+ */
+static int
+end_cycle(APEX_System *system)
+{
+    int i;
+
+    for (i = 0; i < system->num_cores; ++i)
+    {
+        if (!system->cores[i].cpu->halted)
+        {
+            break;
+        }
+    }
+
+    if (i == system->num_cores)
+    {
+        system->halted = TRUE;
+        return TRUE;
+    }
+
+    interconnect(system);
+    system->cycle++;
+
+    return system->config.max_cycles
+           && system->cycle >= system->config.max_cycles;
+}
+
+/*
+ * Sense reversing barrier. Threads spin, a cycle being far shorter than a
+ * futex wake up, and yield once they have spun for a while so that more
+ * threads than host cores still make progress.
+ */
+typedef struct System_Barrier
+{
+    atomic_int count;
+    atomic_int sense;
+    int num_threads;
+} System_Barrier;
+
+#define BARRIER_SPINS 1000
+
+static void
+barrier_wait(System_Barrier *barrier, int *local_sense)
+{
+    int spins = 0;
+
+    *local_sense = !*local_sense;
+    if (atomic_fetch_sub_explicit(&barrier->count, 1, memory_order_acq_rel)
+        == 1)
+    {
+        atomic_store_explicit(&barrier->count, barrier->num_threads,
+                              memory_order_relaxed);
+        atomic_store_explicit(&barrier->sense, *local_sense,
+                              memory_order_release);
+        return;
+    }
+
+    while (atomic_load_explicit(&barrier->sense, memory_order_acquire)
+           != *local_sense)
+    {
+        if (++spins > BARRIER_SPINS)
+        {
+            sched_yield();
+        }
+    }
+}
+
+typedef struct System_Worker
+{
+    APEX_System *system;
+    System_Barrier *barrier;
+    atomic_int *go; /* 0 until every thread started, then 1, or -1 to abort */
+    int id;
+    int num_threads;
+    int *done;
+} System_Worker;
+
+/* Worker 0 also runs the interconnect phase between the two barriers */
+static void *
+system_worker(void *arg)
+{
+    System_Worker *worker = arg;
+    int sense = 0;
+    int go;
+
+    while ((go = atomic_load_explicit(worker->go, memory_order_acquire)) == 0)
+    {
+        sched_yield();
+    }
+
+    if (go < 0)
+    {
+        return NULL;
+    }
+
+    while (TRUE)
+    {
+        step_cores(worker->system, worker->id, worker->num_threads);
+        barrier_wait(worker->barrier, &sense);
+
+        if (worker->id == 0)
+        {
+            *worker->done = end_cycle(worker->system);
+        }
+        barrier_wait(worker->barrier, &sense);
+
+        if (*worker->done)
+        {
+            return NULL;
+        }
+    }
+}
+
+static int
+run_parallel(APEX_System *system, int num_threads)
+{
+    System_Barrier barrier;
+    System_Worker *workers;
+    pthread_t *threads;
+    atomic_int go;
+    int done = FALSE;
+    int i, started;
+
+    workers = calloc(num_threads, sizeof(System_Worker));
+    threads = calloc(num_threads, sizeof(pthread_t));
+    if (!workers || !threads)
+    {
+        free(workers);
+        free(threads);
+        return -1;
+    }
+
+    atomic_init(&go, 0);
+    atomic_init(&barrier.count, num_threads);
+    atomic_init(&barrier.sense, 0);
+    barrier.num_threads = num_threads;
+
+    for (i = 0; i < num_threads; ++i)
+    {
+        workers[i].system = system;
+        workers[i].barrier = &barrier;
+        workers[i].go = &go;
+        workers[i].id = i;
+        workers[i].num_threads = num_threads;
+        workers[i].done = &done;
+    }
+
+    /* Workers 1.. are threads of their own, worker 0 is the caller */
+    for (started = 1; started < num_threads; ++started)
+    {
+        if (pthread_create(&threads[started], NULL, system_worker,
+                           &workers[started])
+            != 0)
+        {
+            break;
+        }
+    }
+
+    /* Nothing has run yet, so on failure the caller can run serially */
+    atomic_store_explicit(&go, started == num_threads ? 1 : -1,
+                          memory_order_release);
+    if (started == num_threads)
+    {
+        system_worker(&workers[0]);
+    }
+
+    for (i = 1; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    free(workers);
+    free(threads);
+    return started == num_threads ? 0 : -1;
+}
+
+APEX_System *
+APEX_system_create(APEX_Program **programs, const char *const *names,
+                   int num_cores, const APEX_Config *config)
+{
+    APEX_Arena *arena;
+    APEX_System *system;
+    APEX_Config core_config;
+    const APEX_Program *program;
+    int i, j;
+
+    if (config->l1_lines < 1 || config->bus_latency < 1)
+    {
+        fprintf(stderr, "APEX_SYSTEM: l1_lines and bus_latency must be "
+                        "at least 1\n");
+        return NULL;
+    }
+
+    /* Fast-forward would run against private memory */
+    if (config->fast_forward)
+    {
+        fprintf(stderr, "APEX_SYSTEM: fast_forward is not available with "
+                        "more than one core\n");
+        return NULL;
+    }
+
+    /* The cores and their L1s fit in the system's arena, each cpu has its
+     * own */
+    arena = APEX_arena_create(
+        sizeof(APEX_System)
+        + num_cores
+              * (sizeof(APEX_Core) + config->l1_lines * sizeof(APEX_L1_Line)));
+    if (!arena)
+    {
+        return NULL;
+    }
+
+    system = APEX_arena_alloc(arena, sizeof(APEX_System));
+    system->arena = arena;
+    system->config = *config;
+    system->cores = APEX_arena_alloc(arena, num_cores * sizeof(APEX_Core));
+    if (!system->cores)
+    {
+        APEX_arena_destroy(arena);
+        return NULL;
+    }
+    system->num_cores = num_cores;
+
+    /* Cores run headless, the system reports for all of them */
+    core_config = *config;
+    core_config.debug_messages = FALSE;
+    core_config.single_step = FALSE;
+    core_config.quiet = TRUE;
+
+    for (i = 0; i < num_cores; ++i)
+    {
+        system->cores[i].name = names[i];
+        system->cores[i].l1
+            = APEX_arena_alloc(arena, config->l1_lines * sizeof(APEX_L1_Line));
+        system->cores[i].cpu = APEX_cpu_create(programs[i], &core_config);
+        if (!system->cores[i].l1 || !system->cores[i].cpu)
+        {
+            APEX_system_free(system);
+            return NULL;
+        }
+        system->cores[i].cpu->system = system;
+        system->cores[i].cpu->core_id = i;
+
+        program = programs[i];
+        for (j = 0; j < program->data_size; ++j)
+        {
+            system->memory[program->data[j].address] = program->data[j].value;
+        }
+    }
+
+    return system;
+}
+
+int
+APEX_system_run(APEX_System *system, int num_threads)
+{
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* Spinning threads sharing a host core only slow each other down */
+    if (online > 0 && num_threads > online)
+    {
+        num_threads = (int)online;
+    }
+    if (num_threads > system->num_cores)
+    {
+        num_threads = system->num_cores;
+    }
+
+    if (num_threads > 1 && run_parallel(system, num_threads) == 0)
+    {
+        return system->halted;
+    }
+
+    do
+    {
+        step_cores(system, 0, 1);
+    } while (!end_cycle(system));
+
+    return system->halted;
+}
+
+void
+APEX_system_print(const APEX_System *system, FILE *fp)
+{
+    const APEX_Core *core;
+    const APEX_CPU *cpu;
+    int i, r;
+
+    fprintf(fp, "APEX_SYSTEM: %d cores, %d cycles, %lu bus transactions, "
+                "%lu cache to cache, %lu dirty evictions\n",
+            system->num_cores, system->cycle, system->bus_transactions,
+            system->interventions, system->dirty_evictions);
+    fprintf(fp, "%-5s %-20s %10s %12s %8s %8s %8s %8s %8s %11s %9s\n", "core",
+            "program", "cycles", "instructions", "loads", "stores", "hits",
+            "misses", "upgrades", "invalidated", "bus_wait");
+
+    for (i = 0; i < system->num_cores; ++i)
+    {
+        core = &system->cores[i];
+        cpu = core->cpu;
+        fprintf(fp, "%-5d %-20s %10d %12d %8lu %8lu %8lu %8lu %8lu %11lu %9lu"
+                    "%s\n",
+                i, core->name, cpu->clock, cpu->insn_completed,
+                core->stats.loads, core->stats.stores, core->stats.hits,
+                core->stats.misses, core->stats.upgrades,
+                core->stats.invalidated, core->stats.bus_wait_cycles,
+                cpu->halted ? "" : " (running)");
+    }
+
+    for (i = 0; i < system->num_cores; ++i)
+    {
+        cpu = system->cores[i].cpu;
+        fprintf(fp, "\nCore %d registers:\n", i);
+        for (r = 0; r < cpu->config.registers; ++r)
+        {
+            fprintf(fp, "R%-3d[%-3d] ", r, cpu->regs[r]);
+            if (r % 8 == 7 || r == cpu->config.registers - 1)
+            {
+                fprintf(fp, "\n");
+            }
+        }
+    }
+
+    fprintf(fp, "\n========================================== STATE OF "
+                "SHARED DATA MEMORY =========================================\n");
+    for (i = 0; i < 100; ++i)
+    {
+        fprintf(fp, "| \t MEM[%d] \t | \t Data Value = %d \t |\n", i,
+                system->memory[i]);
+    }
+}
+
+void
+APEX_system_free(APEX_System *system)
+{
+    int i;
+
+    if (!system)
+    {
+        return;
+    }
+
+    for (i = 0; i < system->num_cores; ++i)
+    {
+        if (system->cores[i].cpu)
+        {
+            APEX_cpu_stop(system->cores[i].cpu);
+        }
+    }
+    APEX_arena_destroy(system->arena);
+}
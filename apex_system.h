@@ -0,0 +1,111 @@
+/*
+ * apex_system.h
+ * Contains declarations of the multi-core system: APEX cpus running their own
+ * programs on a shared data memory, each through a private L1 kept coherent
+ * by MSI snooping on a single bus
+ */
+#ifndef _APEX_SYSTEM_H_
+#define _APEX_SYSTEM_H_
+
+#include <stdio.h>
+
+#include "apex_cpu.h"
+
+/* Coherence state of an L1 line */
+#define LINE_INVALID 0
+#define LINE_SHARED 1
+#define LINE_MODIFIED 2
+
+/* One line of a direct mapped L1, data lives in the shared memory */
+typedef struct APEX_L1_Line
+{
+    unsigned int tag; /* Line address, address / L1_LINE_WORDS */
+    int state;
+} APEX_L1_Line;
+
+/* A miss or upgrade waiting for, or holding, the bus */
+typedef struct APEX_Bus_Request
+{
+    int pending;    /* Posted this cycle, not yet granted */
+    int granted;    /* Granted, completes at done_cycle */
+    int is_store;
+    int address;
+    int value;      /* Store data, or the loaded value once granted */
+    int done_cycle; /* First cycle the memory stage may complete */
+} APEX_Bus_Request;
+
+typedef struct APEX_Core_Stats
+{
+    unsigned long loads;
+    unsigned long stores;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long upgrades;        /* Stores to a shared line */
+    unsigned long invalidated;     /* Lines taken away by other cores */
+    unsigned long bus_wait_cycles; /* Cycles granted requests waited for the bus */
+} APEX_Core_Stats;
+
+typedef struct APEX_Core
+{
+    APEX_CPU *cpu;
+    const char *name; /* Program file, for reports */
+    APEX_L1_Line *l1;
+    APEX_Bus_Request request;
+    APEX_Core_Stats stats;
+} APEX_Core;
+
+struct APEX_System
+{
+    int num_cores;
+    APEX_Core *cores;
+    int cycle;
+    APEX_Config config;
+    int bus_free_cycle;               /* First cycle the bus is idle */
+    unsigned long bus_transactions;
+    unsigned long interventions;      /* Modified lines supplied by a cache */
+    unsigned long dirty_evictions;
+    int halted;                       /* Every core has retired HALT */
+    APEX_Arena *arena;                /* Holds the system, cores and L1s */
+    int memory[DATA_MEMORY_SIZE];     /* Shared data memory */
+};
+
+/*
+ * Creates one headless core per program, with names used in reports. Data
+ * initializers of every program are applied to the shared memory in core
+ * order. Returns NULL and reports on stderr on failure.
+ */
+APEX_System *APEX_system_create(APEX_Program **programs,
+                                const char *const *names, int num_cores,
+                                const APEX_Config *config);
+
+/*
+ * Runs every core in lock-step until all have retired HALT or max_cycles
+ * is reached, stepping the cores on up to num_threads host threads. The
+ * results do not depend on the number of threads. Returns TRUE if every
+ * core halted.
+ */
+int APEX_system_run(APEX_System *system, int num_threads);
+
+/* Prints per core and interconnect statistics, then the shared memory */
+void APEX_system_print(const APEX_System *system, FILE *fp);
+
+void APEX_system_free(APEX_System *system);
+
+/*
+ * Memory stage access of core to the shared memory for a LOAD, LDI, STORE
+ * or STI in stage, at the given cycle. Returns TRUE once the access has
+ * completed, loads having their value in result_buffer, or FALSE while the
+ * memory stage must hold the instruction.
+ */
+int APEX_system_access(APEX_System *system, int core, CPU_Stage *stage,
+                       int cycle);
+
+/*
+ * Whether APEX_system_access would complete the access in stage at the
+ * given cycle, without making it. Lets the pipeline know before the memory
+ * stage runs that it holds.
+ */
+int APEX_system_ready(const APEX_System *system, int core,
+                      const CPU_Stage *stage, int cycle);
+
+#endif
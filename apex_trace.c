@@ -0,0 +1,826 @@
+/*
+ * apex_trace.c
+ * Contains the dynamic instruction trace recorder and the buffered reader
+ * used by trace-driven simulation
+ */
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apex_macros.h"
+#include "apex_trace.h"
+
+#define TRACE_WINDOW 4096 /* Records kept in memory, a power of two */
+#define TRACE_KEEP 16     /* Records kept behind the newest on a refill */
+#define TRACE_CHUNK (TRACE_WINDOW - TRACE_KEEP)
+#define TRACE_INSN_CACHE 1024 /* Per-pc instruction slots, a power of two */
+#define TRACE_WRITE_BUFFER (1 << 20)
+
+static const char trace_magic[APEX_TRACE_HEADER_SIZE - 1] = "APEXTRC";
+static const char index_magic[8] = "APEXIDX";
+
+/* Static fields of the instruction last seen at a pc */
+typedef struct Insn_Slot
+{
+    int32_t pc;
+    int32_t imm;
+    uint8_t opcode;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t valid;
+} Insn_Slot;
+
+/* Delta coding state, kept identically by the recorder and the reader and
+ * reset at every sync point */
+typedef struct Delta_State
+{
+    int32_t prev_pc;
+    int32_t prev_address;
+    int32_t regs[MAX_REG_FILE_SIZE]; /* Last value written to each register */
+    Insn_Slot insn[TRACE_INSN_CACHE];
+} Delta_State;
+
+typedef struct Sync_Point
+{
+    uint64_t seq;
+    uint64_t offset;
+} Sync_Point;
+
+struct APEX_Trace
+{
+    FILE *fp;
+    char *filename;
+    int version;
+    unsigned long first; /* Oldest record still in the window */
+    unsigned long end;   /* One past the newest record read */
+    int done;            /* Nothing more to read */
+    APEX_Trace_Record halt;
+    Delta_State state;
+    Sync_Point *index;   /* Version 2 sync points, loaded on the first seek */
+    int index_size;
+    APEX_Trace_Record window[TRACE_WINDOW];
+    size_t raw_pos;
+    size_t raw_len;
+    unsigned char raw[TRACE_CHUNK * APEX_TRACE_RECORD_SIZE];
+};
+
+struct APEX_Trace_Writer
+{
+    FILE *fp;
+    char *filename;
+    unsigned long seq;
+    uint64_t offset; /* Bytes written so far */
+    Sync_Point *index;
+    int index_size;
+    int index_capacity;
+    int error;
+    Delta_State state;
+};
+
+static int
+valid_opcode(int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_MOVC:
+        case OPCODE_LOAD:
+        case OPCODE_STORE:
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_LDI:
+        case OPCODE_STI:
+        case OPCODE_CMP:
+        case OPCODE_NOP:
+        case OPCODE_JUMP:
+        case OPCODE_BZ:
+        case OPCODE_BNZ:
+        case OPCODE_HALT:
+        case OPCODE_BP:
+        case OPCODE_BNP:
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static int
+writes_rd(int opcode)
+{
+    switch (opcode)
+    {
+        case OPCODE_ADD:
+        case OPCODE_SUB:
+        case OPCODE_MUL:
+        case OPCODE_DIV:
+        case OPCODE_AND:
+        case OPCODE_OR:
+        case OPCODE_XOR:
+        case OPCODE_ADDL:
+        case OPCODE_SUBL:
+        case OPCODE_MOVC:
+        case OPCODE_LOAD:
+        case OPCODE_LDI:
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static int
+accesses_memory(int opcode)
+{
+    return opcode == OPCODE_LOAD || opcode == OPCODE_STORE
+           || opcode == OPCODE_LDI || opcode == OPCODE_STI;
+}
+
+/* The pipeline indexes the register file with these directly */
+static int
+valid_record(const APEX_Trace_Record *rec)
+{
+    return valid_opcode(rec->opcode) && rec->rd < MAX_REG_FILE_SIZE
+           && rec->rs1 < MAX_REG_FILE_SIZE && rec->rs2 < MAX_REG_FILE_SIZE;
+}
+
+static void
+reset_state(Delta_State *state, int32_t pc)
+{
+    memset(state, 0, sizeof(Delta_State));
+    state->prev_pc = (int32_t)((uint32_t)pc - 4);
+}
+
+static Insn_Slot *
+insn_slot(Delta_State *state, int32_t pc)
+{
+    return &state->insn[((uint32_t)pc >> 2) & (TRACE_INSN_CACHE - 1)];
+}
+
+static int32_t
+add32(int32_t a, int32_t b)
+{
+    return (int32_t)((uint32_t)a + (uint32_t)b);
+}
+
+static int32_t
+sub32(int32_t a, int32_t b)
+{
+    return (int32_t)((uint32_t)a - (uint32_t)b);
+}
+
+static uint64_t
+get_le(const unsigned char *p, int size)
+{
+    uint64_t value = 0;
+    int i;
+
+    for (i = size - 1; i >= 0; --i)
+    {
+        value = value << 8 | p[i];
+    }
+
+    return value;
+}
+
+/* Reader */
+
+static int
+next_byte(APEX_Trace *trace)
+{
+    if (trace->raw_pos == trace->raw_len)
+    {
+        trace->raw_len = fread(trace->raw, 1, sizeof(trace->raw), trace->fp);
+        trace->raw_pos = 0;
+        if (trace->raw_len == 0)
+        {
+            return -1;
+        }
+    }
+
+    return trace->raw[trace->raw_pos++];
+}
+
+static int
+read_bytes(APEX_Trace *trace, unsigned char *dst, size_t size)
+{
+    size_t i;
+    int c;
+
+    for (i = 0; i < size; ++i)
+    {
+        c = next_byte(trace);
+        if (c < 0)
+        {
+            return FALSE;
+        }
+        dst[i] = c;
+    }
+
+    return TRUE;
+}
+
+static int
+read_varint(APEX_Trace *trace, int32_t *value)
+{
+    uint32_t zigzag = 0;
+    int shift, c;
+
+    for (shift = 0; shift < 35; shift += 7)
+    {
+        c = next_byte(trace);
+        if (c < 0)
+        {
+            return FALSE;
+        }
+
+        zigzag |= (uint32_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+        {
+            *value = (int32_t)((zigzag >> 1) ^ -(zigzag & 1));
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/* Returns 1 for a record, 0 at the end of the trace, -1 if it is malformed */
+static int
+read_v1(APEX_Trace *trace, APEX_Trace_Record *rec)
+{
+    unsigned char p[APEX_TRACE_RECORD_SIZE];
+    int c;
+
+    c = next_byte(trace);
+    if (c < 0)
+    {
+        return 0;
+    }
+
+    p[0] = c;
+    if (!read_bytes(trace, p + 1, sizeof(p) - 1))
+    {
+        return -1;
+    }
+
+    rec->pc = (int32_t)get_le(p, 4);
+    rec->imm = (int32_t)get_le(p + 4, 4);
+    rec->memory_address = (int32_t)get_le(p + 8, 4);
+    rec->result = (int32_t)get_le(p + 12, 4);
+    rec->opcode = p[16];
+    rec->rd = p[17];
+    rec->rs1 = p[18];
+    rec->rs2 = p[19];
+    rec->flags = p[20] & APEX_TRACE_TAKEN;
+    return valid_record(rec) ? 1 : -1;
+}
+
+static int
+read_v2(APEX_Trace *trace, APEX_Trace_Record *rec)
+{
+    Delta_State *state = &trace->state;
+    unsigned char p[12];
+    Insn_Slot *slot;
+    int32_t delta;
+    int flags;
+
+    flags = next_byte(trace);
+    if (flags == APEX_TRACE_SYNC)
+    {
+        if (!read_bytes(trace, p, 12) || get_le(p, 8) != trace->end)
+        {
+            return -1;
+        }
+        reset_state(state, (int32_t)get_le(p + 8, 4));
+        flags = next_byte(trace);
+    }
+
+    /* A recording cut short still replays up to its last record */
+    if (flags < 0 || flags == APEX_TRACE_END)
+    {
+        return 0;
+    }
+
+    if (flags & ~(APEX_TRACE_TAKEN | APEX_TRACE_PC | APEX_TRACE_INSN))
+    {
+        return -1;
+    }
+
+    rec->pc = add32(state->prev_pc, 4);
+    if (flags & APEX_TRACE_PC)
+    {
+        if (!read_varint(trace, &delta))
+        {
+            return -1;
+        }
+        rec->pc = add32(rec->pc, delta);
+    }
+
+    slot = insn_slot(state, rec->pc);
+    if (flags & APEX_TRACE_INSN)
+    {
+        if (!read_bytes(trace, p, 4) || !read_varint(trace, &slot->imm))
+        {
+            return -1;
+        }
+        slot->pc = rec->pc;
+        slot->opcode = p[0];
+        slot->rd = p[1];
+        slot->rs1 = p[2];
+        slot->rs2 = p[3];
+        slot->valid = TRUE;
+    }
+    else if (!slot->valid || slot->pc != rec->pc)
+    {
+        return -1;
+    }
+
+    rec->imm = slot->imm;
+    rec->opcode = slot->opcode;
+    rec->rd = slot->rd;
+    rec->rs1 = slot->rs1;
+    rec->rs2 = slot->rs2;
+    rec->flags = flags & APEX_TRACE_TAKEN;
+    rec->result = 0;
+    rec->memory_address = 0;
+    if (!valid_record(rec))
+    {
+        return -1;
+    }
+
+    if (writes_rd(rec->opcode))
+    {
+        if (!read_varint(trace, &delta))
+        {
+            return -1;
+        }
+        rec->result = add32(state->regs[rec->rd], delta);
+        state->regs[rec->rd] = rec->result;
+    }
+
+    if (accesses_memory(rec->opcode))
+    {
+        if (!read_varint(trace, &delta))
+        {
+            return -1;
+        }
+        rec->memory_address = add32(state->prev_address, delta);
+        state->prev_address = rec->memory_address;
+    }
+
+    state->prev_pc = rec->pc;
+    return 1;
+}
+
+/* Decodes the next chunk of records, dropping all but the newest few */
+static void
+refill(APEX_Trace *trace)
+{
+    APEX_Trace_Record *rec;
+    int i, ret;
+
+    if (trace->end - trace->first > TRACE_KEEP)
+    {
+        trace->first = trace->end - TRACE_KEEP;
+    }
+
+    for (i = 0; i < TRACE_CHUNK; ++i)
+    {
+        rec = &trace->window[trace->end & (TRACE_WINDOW - 1)];
+        ret = (trace->version == 1) ? read_v1(trace, rec)
+                                    : read_v2(trace, rec);
+        if (ret <= 0)
+        {
+            if (ret < 0 || ferror(trace->fp))
+            {
+                fprintf(stderr, "%s: malformed record %lu, trace ends here\n",
+                        trace->filename, trace->end);
+            }
+            trace->done = TRUE;
+            return;
+        }
+        trace->end++;
+    }
+}
+
+/*
+ * Reads the sync point index from the end of a version 2 trace. A recording
+ * cut short has no index, but always its first sync point right after the
+ * header, so seeking still works by decoding from there.
+ */
+static int
+load_index(APEX_Trace *trace)
+{
+    unsigned char p[16];
+    uint64_t offset;
+    uint32_t count, i;
+
+    if (fseek(trace->fp, -16, SEEK_END) == 0
+        && fread(p, 1, sizeof(p), trace->fp) == sizeof(p)
+        && memcmp(p + 8, index_magic, sizeof(index_magic)) == 0)
+    {
+        offset = get_le(p, 8);
+        if (fseek(trace->fp, (long)offset, SEEK_SET) == 0
+            && fread(p, 1, 4, trace->fp) == 4)
+        {
+            count = (uint32_t)get_le(p, 4);
+            trace->index = calloc(count ? count : 1, sizeof(Sync_Point));
+            if (!trace->index)
+            {
+                return -1;
+            }
+
+            for (i = 0; i < count; ++i)
+            {
+                if (fread(p, 1, 16, trace->fp) != 16)
+                {
+                    break;
+                }
+                trace->index[i].seq = get_le(p, 8);
+                trace->index[i].offset = get_le(p + 8, 8);
+                /* Sync points are in record order, a bad index is ignored */
+                if (i > 0 && trace->index[i].seq <= trace->index[i - 1].seq)
+                {
+                    break;
+                }
+            }
+
+            if (i == count && count > 0)
+            {
+                trace->index_size = count;
+                return 0;
+            }
+            free(trace->index);
+        }
+    }
+
+    trace->index = calloc(1, sizeof(Sync_Point));
+    if (!trace->index)
+    {
+        return -1;
+    }
+    trace->index[0].seq = 0;
+    trace->index[0].offset = APEX_TRACE_HEADER_SIZE;
+    trace->index_size = 1;
+    return 0;
+}
+
+int
+APEX_trace_seek(APEX_Trace *trace, unsigned long seq)
+{
+    unsigned long start;
+    uint64_t offset;
+    int lo, hi, mid;
+
+    if (trace->version == 1)
+    {
+        start = seq;
+        offset = APEX_TRACE_HEADER_SIZE
+                 + (uint64_t)seq * APEX_TRACE_RECORD_SIZE;
+    }
+    else
+    {
+        if (!trace->index && load_index(trace) != 0)
+        {
+            return -1;
+        }
+
+        /* Last sync point at or before seq, the first is record 0 */
+        lo = 0;
+        hi = trace->index_size - 1;
+        while (lo < hi)
+        {
+            mid = (lo + hi + 1) / 2;
+            if (trace->index[mid].seq <= seq)
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid - 1;
+            }
+        }
+        start = trace->index[lo].seq;
+        offset = trace->index[lo].offset;
+    }
+
+    if (fseek(trace->fp, (long)offset, SEEK_SET) != 0)
+    {
+        return -1;
+    }
+
+    /* The sync point resets the decoder state as its record is read */
+    trace->raw_pos = 0;
+    trace->raw_len = 0;
+    trace->first = start;
+    trace->end = start;
+    trace->done = FALSE;
+    return 0;
+}
+
+APEX_Trace *
+APEX_trace_open(const char *filename)
+{
+    APEX_Trace *trace;
+    unsigned char header[APEX_TRACE_HEADER_SIZE];
+
+    trace = calloc(1, sizeof(APEX_Trace));
+    if (!trace)
+    {
+        return NULL;
+    }
+
+    trace->filename = strdup(filename);
+    trace->fp = fopen(filename, "rb");
+    if (!trace->filename || !trace->fp)
+    {
+        fprintf(stderr, "%s: unable to open trace\n", filename);
+        APEX_trace_close(trace);
+        return NULL;
+    }
+
+    if (fread(header, 1, sizeof(header), trace->fp) != sizeof(header)
+        || memcmp(header, trace_magic, sizeof(trace_magic)) != 0
+        || (header[APEX_TRACE_HEADER_SIZE - 1] != 1
+            && header[APEX_TRACE_HEADER_SIZE - 1] != APEX_TRACE_VERSION))
+    {
+        fprintf(stderr, "%s: not an APEX trace, or unsupported version\n",
+                filename);
+        APEX_trace_close(trace);
+        return NULL;
+    }
+    trace->version = header[APEX_TRACE_HEADER_SIZE - 1];
+
+    /* Chunks are read strictly in order, let the kernel read ahead */
+    posix_fadvise(fileno(trace->fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+    return trace;
+}
+
+const APEX_Trace_Record *
+APEX_trace_get(APEX_Trace *trace, unsigned long seq)
+{
+    /* Restart decoding for a record behind the window, or one far enough
+     * ahead that a later sync point is closer */
+    if ((seq < trace->first
+         || (seq >= trace->end + APEX_TRACE_SYNC_INTERVAL && !trace->done))
+        && APEX_trace_seek(trace, seq) != 0)
+    {
+        trace->done = TRUE;
+    }
+
+    while (seq >= trace->end && !trace->done)
+    {
+        refill(trace);
+    }
+
+    /* In-flight instructions are never more than TRACE_KEEP records old */
+    if (seq < trace->end)
+    {
+        return &trace->window[seq & (TRACE_WINDOW - 1)];
+    }
+
+    memset(&trace->halt, 0, sizeof(trace->halt));
+    trace->halt.opcode = OPCODE_HALT;
+    trace->halt.pc
+        = trace->end ? trace->window[(trace->end - 1) & (TRACE_WINDOW - 1)].pc
+                           + 4
+                     : 4000;
+    return &trace->halt;
+}
+
+void
+APEX_trace_close(APEX_Trace *trace)
+{
+    if (!trace)
+    {
+        return;
+    }
+
+    if (trace->fp)
+    {
+        fclose(trace->fp);
+    }
+    free(trace->index);
+    free(trace->filename);
+    free(trace);
+}
+
+/* Recorder */
+
+static void
+put_bytes(APEX_Trace_Writer *writer, const void *src, size_t size)
+{
+    if (fwrite(src, 1, size, writer->fp) != size)
+    {
+        writer->error = TRUE;
+    }
+    writer->offset += size;
+}
+
+static void
+put_le(APEX_Trace_Writer *writer, uint64_t value, int size)
+{
+    unsigned char p[8];
+    int i;
+
+    for (i = 0; i < size; ++i)
+    {
+        p[i] = value >> (8 * i);
+    }
+    put_bytes(writer, p, size);
+}
+
+static void
+put_varint(APEX_Trace_Writer *writer, int32_t value)
+{
+    uint32_t zigzag = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    unsigned char p[5];
+    size_t size = 0;
+
+    do
+    {
+        p[size] = zigzag & 0x7f;
+        zigzag >>= 7;
+        if (zigzag)
+        {
+            p[size] |= 0x80;
+        }
+        size++;
+    } while (zigzag);
+
+    put_bytes(writer, p, size);
+}
+
+static void
+put_sync_point(APEX_Trace_Writer *writer, int32_t pc)
+{
+    Sync_Point *index;
+    int capacity;
+
+    if (writer->index_size == writer->index_capacity)
+    {
+        capacity = writer->index_capacity ? 2 * writer->index_capacity : 64;
+        index = realloc(writer->index, capacity * sizeof(Sync_Point));
+        if (!index)
+        {
+            writer->error = TRUE;
+            return;
+        }
+        writer->index = index;
+        writer->index_capacity = capacity;
+    }
+
+    writer->index[writer->index_size].seq = writer->seq;
+    writer->index[writer->index_size].offset = writer->offset;
+    writer->index_size++;
+
+    put_le(writer, APEX_TRACE_SYNC, 1);
+    put_le(writer, writer->seq, 8);
+    put_le(writer, (uint32_t)pc, 4);
+    reset_state(&writer->state, pc);
+}
+
+APEX_Trace_Writer *
+APEX_trace_writer_open(const char *filename)
+{
+    APEX_Trace_Writer *writer;
+
+    writer = calloc(1, sizeof(APEX_Trace_Writer));
+    if (!writer)
+    {
+        return NULL;
+    }
+
+    writer->filename = strdup(filename);
+    writer->fp = fopen(filename, "wb");
+    if (!writer->filename || !writer->fp)
+    {
+        fprintf(stderr, "%s: unable to create trace\n", filename);
+        if (writer->fp)
+        {
+            fclose(writer->fp);
+        }
+        free(writer->filename);
+        free(writer);
+        return NULL;
+    }
+
+    /* Records are a few bytes each, keep stdio from writing them one by one */
+    setvbuf(writer->fp, NULL, _IOFBF, TRACE_WRITE_BUFFER);
+
+    put_bytes(writer, trace_magic, sizeof(trace_magic));
+    put_le(writer, APEX_TRACE_VERSION, 1);
+    return writer;
+}
+
+void
+APEX_trace_write(APEX_Trace_Writer *writer, const APEX_Trace_Record *rec)
+{
+    Delta_State *state = &writer->state;
+    Insn_Slot *slot;
+    int32_t next_pc;
+    int flags;
+
+    if (writer->seq % APEX_TRACE_SYNC_INTERVAL == 0)
+    {
+        put_sync_point(writer, rec->pc);
+    }
+
+    flags = rec->flags & APEX_TRACE_TAKEN;
+    next_pc = add32(state->prev_pc, 4);
+    if (rec->pc != next_pc)
+    {
+        flags |= APEX_TRACE_PC;
+    }
+
+    slot = insn_slot(state, rec->pc);
+    if (!slot->valid || slot->pc != rec->pc || slot->imm != rec->imm
+        || slot->opcode != rec->opcode || slot->rd != rec->rd
+        || slot->rs1 != rec->rs1 || slot->rs2 != rec->rs2)
+    {
+        flags |= APEX_TRACE_INSN;
+        slot->pc = rec->pc;
+        slot->imm = rec->imm;
+        slot->opcode = rec->opcode;
+        slot->rd = rec->rd;
+        slot->rs1 = rec->rs1;
+        slot->rs2 = rec->rs2;
+        slot->valid = TRUE;
+    }
+
+    put_le(writer, flags, 1);
+    if (flags & APEX_TRACE_PC)
+    {
+        put_varint(writer, sub32(rec->pc, next_pc));
+    }
+
+    if (flags & APEX_TRACE_INSN)
+    {
+        put_le(writer, rec->opcode, 1);
+        put_le(writer, rec->rd, 1);
+        put_le(writer, rec->rs1, 1);
+        put_le(writer, rec->rs2, 1);
+        put_varint(writer, rec->imm);
+    }
+
+    if (writes_rd(rec->opcode))
+    {
+        put_varint(writer, sub32(rec->result, state->regs[rec->rd]));
+        state->regs[rec->rd] = rec->result;
+    }
+
+    if (accesses_memory(rec->opcode))
+    {
+        put_varint(writer, sub32(rec->memory_address, state->prev_address));
+        state->prev_address = rec->memory_address;
+    }
+
+    state->prev_pc = rec->pc;
+    writer->seq++;
+}
+
+int
+APEX_trace_writer_close(APEX_Trace_Writer *writer)
+{
+    uint64_t index_offset;
+    int i, ret;
+
+    put_le(writer, APEX_TRACE_END, 1);
+    index_offset = writer->offset;
+    put_le(writer, writer->index_size, 4);
+    for (i = 0; i < writer->index_size; ++i)
+    {
+        put_le(writer, writer->index[i].seq, 8);
+        put_le(writer, writer->index[i].offset, 8);
+    }
+    put_le(writer, index_offset, 8);
+    put_bytes(writer, index_magic, sizeof(index_magic));
+
+    if (fclose(writer->fp) != 0)
+    {
+        writer->error = TRUE;
+    }
+
+    ret = 0;
+    if (writer->error)
+    {
+        fprintf(stderr, "%s: error writing trace\n", writer->filename);
+        ret = -1;
+    }
+
+    free(writer->index);
+    free(writer->filename);
+    free(writer);
+    return ret;
+}
@@ -0,0 +1,116 @@
+/*
+ * apex_trace.h
+ * Contains declarations of the dynamic instruction trace formats, reader and
+ * recorder
+ *
+ * A trace file starts with the 8 byte header "APEXTRC" followed by a version
+ * byte. All multi-byte fields are little-endian.
+ *
+ * Version 1 holds one fixed size record per retired instruction:
+ *
+ *   offset  size  field
+ *        0     4  pc
+ *        4     4  imm
+ *        8     4  memory_address  Effective address of LOAD/STORE/LDI/STI
+ *       12     4  result          Value written to rd, 0 if none
+ *       16     1  opcode          OPCODE_* from apex_macros.h
+ *       17     1  rd
+ *       18     1  rs1
+ *       19     1  rs2
+ *       20     1  flags           APEX_TRACE_TAKEN for a taken branch/JUMP
+ *       21     3  reserved, zero
+ *
+ * Version 2, written by the recorder, delta-encodes the same fields against
+ * a decoder state. Every record starts with a flags byte:
+ *
+ *   APEX_TRACE_TAKEN   Taken branch or JUMP
+ *   APEX_TRACE_PC      pc is not the previous pc + 4, a varint delta from
+ *                      previous pc + 4 follows
+ *   APEX_TRACE_INSN    opcode, rd, rs1, rs2 bytes and a varint imm follow,
+ *                      otherwise they are those last seen at this pc
+ *
+ * Then for instructions writing rd, a varint delta from the last value of
+ * rd, and for memory instructions a varint delta from the previous address.
+ * Varints are zigzag encoded LEB128.
+ *
+ * A sync point, flags byte APEX_TRACE_SYNC followed by the 8 byte number of
+ * the next record and its 4 byte pc, precedes every APEX_TRACE_SYNC_INTERVAL
+ * records and resets the decoder state, so decoding can start at any of
+ * them. The stream ends with an APEX_TRACE_END byte, a 4 byte count and
+ * that many pairs of 8 byte record number and 8 byte file offset of each
+ * sync point, then the 8 byte file offset of the count and "APEXIDX\0".
+ */
+#ifndef _APEX_TRACE_H_
+#define _APEX_TRACE_H_
+
+#include <stdint.h>
+
+#define APEX_TRACE_VERSION 2
+#define APEX_TRACE_HEADER_SIZE 8
+#define APEX_TRACE_RECORD_SIZE 24 /* Version 1 */
+#define APEX_TRACE_SYNC_INTERVAL 4096
+
+/* Record flags */
+#define APEX_TRACE_TAKEN 0x1
+#define APEX_TRACE_PC 0x2
+#define APEX_TRACE_INSN 0x4
+#define APEX_TRACE_END 0x40
+#define APEX_TRACE_SYNC 0x80
+
+/* One retired instruction */
+typedef struct APEX_Trace_Record
+{
+    int32_t pc;
+    int32_t imm;
+    int32_t memory_address;
+    int32_t result;
+    uint8_t opcode;
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t flags;
+} APEX_Trace_Record;
+
+typedef struct APEX_Trace APEX_Trace;
+typedef struct APEX_Trace_Writer APEX_Trace_Writer;
+
+/*
+ * Opens a trace of either version for reading, returns NULL and reports on
+ * stderr if the file cannot be opened or is not a trace.
+ */
+APEX_Trace *APEX_trace_open(const char *filename);
+
+/*
+ * Returns record number seq, counting from 0. Records are read ahead in large
+ * chunks and the most recent ones stay in a window. A seq behind the window,
+ * or more than a sync interval ahead of it, seeks with APEX_trace_seek. Past
+ * the end of the trace, or at a malformed record, a HALT following the last
+ * good record is returned.
+ */
+const APEX_Trace_Record *APEX_trace_get(APEX_Trace *trace, unsigned long seq);
+
+/*
+ * Restarts decoding so that record seq is read next: directly in a version 1
+ * trace, from the last sync point at or before seq in a version 2 one. The
+ * index of sync points is read from the end of the file on the first seek.
+ * Returns 0, or -1 if the file cannot be positioned.
+ */
+int APEX_trace_seek(APEX_Trace *trace, unsigned long seq);
+
+void APEX_trace_close(APEX_Trace *trace);
+
+/*
+ * Creates a version 2 trace, returns NULL and reports on stderr on failure
+ */
+APEX_Trace_Writer *APEX_trace_writer_open(const char *filename);
+
+/* Appends one retired instruction */
+void APEX_trace_write(APEX_Trace_Writer *writer, const APEX_Trace_Record *rec);
+
+/*
+ * Writes the sync point index and closes the file. Returns 0 on success,
+ * otherwise reports on stderr.
+ */
+int APEX_trace_writer_close(APEX_Trace_Writer *writer);
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * apex_translate.c
+ * Contains the functional fast-forward engine. Each basic block of code
+ * memory, ending at a branch or JUMP, is translated on first entry into an
+ * array of handler calls with the register operands resolved to pointers,
+ * and cached by entry pc. Flags are kept lazily like the pipeline's.
+ */
+#include <stdlib.h>
+
+#include "apex_cpu.h"
+#include "apex_macros.h"
+#include "apex_translate.h"
+
+/* Machine state the handlers run against */
+typedef struct FF_State
+{
+    int *memory;
+    int flags;   /* As APEX_CPU flags */
+    int next_pc; /* Where the block goes, set by its branch */
+} FF_State;
+
+typedef struct FF_Op FF_Op;
+typedef void (*FF_Handler)(FF_State *ff, const FF_Op *op);
+
+/* One translated instruction */
+struct FF_Op
+{
+    FF_Handler run;
+    int *rd;
+    int *rs1;
+    int *rs2;
+    int imm;
+    int pc;
+};
+
+typedef struct FF_Block
+{
+    int num_ops; /* Instructions run by the block, HALT excluded */
+    int halts;   /* The block ends in front of HALT */
+    FF_Op ops[];
+} FF_Block;
+
+static int
+code_index(int pc)
+{
+    return (pc - 4000) / 4;
+}
+
+/* Same flag update as execute: ADD, SUB, MUL, DIV, ADDL and SUBL set both
+ * flags from their result */
+#define FF_ALU(name, expr, sets_flags)                                         \
+    static void name(FF_State *ff, const FF_Op *op)                           \
+    {                                                                          \
+        int a = *op->rs1, b = *op->rs2, result = (expr);                      \
+        (void)a;                                                               \
+        (void)b;                                                               \
+        *op->rd = result;                                                      \
+        if (sets_flags)                                                        \
+        {                                                                      \
+            ff->flags = result;                                                \
+        }                                                                      \
+    }
+
+/* Wrapping at 32 bits like the pipeline ALU */
+FF_ALU(ff_add, (int)((uint32_t)a + (uint32_t)b), TRUE)
+FF_ALU(ff_sub, (int)((uint32_t)a - (uint32_t)b), TRUE)
+FF_ALU(ff_mul, (int)((uint32_t)a * (uint32_t)b), TRUE)
+FF_ALU(ff_div, a / b, TRUE)
+FF_ALU(ff_and, a & b, FALSE)
+FF_ALU(ff_or, a | b, FALSE)
+FF_ALU(ff_xor, a ^ b, FALSE)
+FF_ALU(ff_addl, (int)((uint32_t)a + (uint32_t)op->imm), TRUE)
+FF_ALU(ff_subl, (int)((uint32_t)a - (uint32_t)op->imm), TRUE)
+FF_ALU(ff_movc, op->imm, FALSE)
+
+static void
+ff_load(FF_State *ff, const FF_Op *op)
+{
+    *op->rd = ff->memory[*op->rs1 + op->imm];
+}
+
+/* The loaded value is written before the incremented base, as writeback
+ * does */
+static void
+ff_ldi(FF_State *ff, const FF_Op *op)
+{
+    int base = *op->rs1;
+
+    *op->rd = ff->memory[base + op->imm];
+    *op->rs1 = base + 4;
+}
+
+static void
+ff_store(FF_State *ff, const FF_Op *op)
+{
+    ff->memory[*op->rs2 + op->imm] = *op->rs1;
+}
+
+static void
+ff_sti(FF_State *ff, const FF_Op *op)
+{
+    int base = *op->rs2;
+
+    ff->memory[base + op->imm] = *op->rs1;
+    *op->rs2 = base + 4;
+}
+
+/* CMP leaves the flags alone when rs1 is the smaller */
+static void
+ff_cmp(FF_State *ff, const FF_Op *op)
+{
+    if (*op->rs1 == *op->rs2)
+    {
+        ff->flags = 0;
+    }
+    else if (*op->rs1 > *op->rs2)
+    {
+        ff->flags = 1;
+    }
+}
+
+static void
+ff_nop(FF_State *ff, const FF_Op *op)
+{
+    (void)ff;
+    (void)op;
+}
+
+static void
+ff_jump(FF_State *ff, const FF_Op *op)
+{
+    ff->next_pc = *op->rs1 + op->imm;
+}
+
+static void
+ff_bz(FF_State *ff, const FF_Op *op)
+{
+    if (ff->flags == 0)
+    {
+        ff->next_pc = op->pc + op->imm;
+    }
+}
+
+static void
+ff_bnz(FF_State *ff, const FF_Op *op)
+{
+    if (ff->flags != 0)
+    {
+        ff->next_pc = op->pc + op->imm;
+    }
+}
+
+static void
+ff_bp(FF_State *ff, const FF_Op *op)
+{
+    if (ff->flags > 0)
+    {
+        ff->next_pc = op->pc + op->imm;
+    }
+}
+
+static void
+ff_bnp(FF_State *ff, const FF_Op *op)
+{
+    if (ff->flags <= 0)
+    {
+        ff->next_pc = op->pc + op->imm;
+    }
+}
+
+static const FF_Handler ff_handlers[NUM_OPCODES] = {
+    [OPCODE_ADD] = ff_add,     [OPCODE_SUB] = ff_sub,
+    [OPCODE_MUL] = ff_mul,     [OPCODE_DIV] = ff_div,
+    [OPCODE_AND] = ff_and,     [OPCODE_OR] = ff_or,
+    [OPCODE_XOR] = ff_xor,     [OPCODE_MOVC] = ff_movc,
+    [OPCODE_LOAD] = ff_load,   [OPCODE_STORE] = ff_store,
+    [OPCODE_ADDL] = ff_addl,   [OPCODE_SUBL] = ff_subl,
+    [OPCODE_LDI] = ff_ldi,     [OPCODE_STI] = ff_sti,
+    [OPCODE_CMP] = ff_cmp,     [OPCODE_NOP] = ff_nop,
+    [OPCODE_JUMP] = ff_jump,   [OPCODE_BZ] = ff_bz,
+    [OPCODE_BNZ] = ff_bnz,     [OPCODE_BP] = ff_bp,
+    [OPCODE_BNP] = ff_bnp,
+};
+
+static int
+ends_block(int opcode)
+{
+    return opcode == OPCODE_JUMP || opcode == OPCODE_BZ
+           || opcode == OPCODE_BNZ || opcode == OPCODE_BP
+           || opcode == OPCODE_BNP;
+}
+
+/* Translates the block entered at code memory index first */
+static FF_Block *
+translate_block(APEX_CPU *cpu, int first)
+{
+    const APEX_Instruction *ins;
+    FF_Block *block;
+    FF_Op *op;
+    int last, i, opcode, halts;
+
+    /* The block runs up to and including its branch, or up to HALT or
+     * the end of code memory */
+    halts = FALSE;
+    for (last = first; last < cpu->code_memory_size; ++last)
+    {
+        opcode = cpu->code_memory[last].opcode;
+        if (opcode == OPCODE_HALT)
+        {
+            halts = TRUE;
+            break;
+        }
+        if (ends_block(opcode))
+        {
+            last++;
+            break;
+        }
+    }
+
+    block = malloc(sizeof(FF_Block) + (last - first) * sizeof(FF_Op));
+    if (!block)
+    {
+        return NULL;
+    }
+
+    block->num_ops = last - first;
+    block->halts = halts;
+
+    for (i = first; i < last; ++i)
+    {
+        ins = &cpu->code_memory[i];
+        op = &block->ops[i - first];
+        op->run = ff_handlers[ins->opcode];
+        op->rd = &cpu->regs[ins->rd];
+        op->rs1 = &cpu->regs[ins->rs1];
+        op->rs2 = &cpu->regs[ins->rs2];
+        op->imm = ins->imm;
+        op->pc = 4000 + 4 * i;
+    }
+
+    return block;
+}
+
+long
+APEX_cpu_fast_forward(APEX_CPU *cpu, long max_insns)
+{
+    FF_Block **blocks;
+    FF_Block *block;
+    FF_State ff;
+    const FF_Op *op, *end;
+    long done = 0;
+    int pc = cpu->pc;
+    int index, i;
+
+    blocks = calloc(cpu->code_memory_size, sizeof(FF_Block *));
+    if (!blocks && cpu->code_memory_size > 0)
+    {
+        return -1;
+    }
+
+    ff.memory = cpu->data_memory;
+    ff.flags = cpu->flags;
+
+    while (done < max_insns)
+    {
+        index = code_index(pc);
+        if (pc < 4000 || (pc - 4000) % 4 != 0
+            || index >= cpu->code_memory_size)
+        {
+            break;
+        }
+
+        block = blocks[index];
+        if (!block)
+        {
+            block = translate_block(cpu, index);
+            if (!block)
+            {
+                done = -1;
+                break;
+            }
+            blocks[index] = block;
+        }
+
+        /* The branch, if any, is last, so a partly run block falls through */
+        end = block->ops + block->num_ops;
+        if (block->num_ops > max_insns - done)
+        {
+            end = block->ops + (max_insns - done);
+        }
+
+        ff.next_pc = pc + 4 * (int)(end - block->ops);
+        for (op = block->ops; op < end; ++op)
+        {
+            op->run(&ff, op);
+        }
+
+        done += end - block->ops;
+        pc = ff.next_pc;
+        if (block->halts && end == block->ops + block->num_ops)
+        {
+            break;
+        }
+    }
+
+    if (done >= 0)
+    {
+        cpu->pc = pc;
+        cpu->flags = ff.flags;
+    }
+
+    for (i = 0; i < cpu->code_memory_size; ++i)
+    {
+        free(blocks[i]);
+    }
+    free(blocks);
+    return done;
+}
@@ -0,0 +1,21 @@
+/*
+ * apex_translate.h
+ * Contains declarations of the functional fast-forward engine, which runs a
+ * program as basic blocks translated into threaded code, without modelling
+ * the pipeline
+ */
+#ifndef _APEX_TRANSLATE_H_
+#define _APEX_TRANSLATE_H_
+
+#include "apex_cpu.h"
+
+/*
+ * Runs up to max_insns instructions of the program of cpu from cpu->pc,
+ * updating only architectural state: registers, flags, data memory and pc.
+ * Stops early in front of HALT, or when pc leaves code memory, so that the
+ * pipeline picks up from there. Must be called before the first cycle.
+ * Returns the number of instructions run, or -1 if out of memory.
+ */
+long APEX_cpu_fast_forward(APEX_CPU *cpu, long max_insns);
+
+#endif
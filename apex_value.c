@@ -0,0 +1,101 @@
+/*
+ * apex_value.c
+ * Contains the value and address profiler and the stride value predictor
+ */
+#include "apex_value.h"
+
+void
+APEX_value_sample(APEX_Value_History *history, int value)
+{
+    if (history->samples > 0)
+    {
+        if (value == history->last)
+        {
+            history->constant++;
+        }
+        else if (history->samples > 1
+                 && value - history->last == history->stride)
+        {
+            history->strided++;
+        }
+        else
+        {
+            history->random++;
+        }
+        history->stride = value - history->last;
+    }
+
+    history->last = value;
+    history->samples++;
+}
+
+const char *
+APEX_value_class(const APEX_Value_History *history)
+{
+    unsigned long classified = history->samples - 1;
+
+    if (history->samples < 2)
+    {
+        return "-";
+    }
+    if (100 * history->constant >= VALUE_PREDICTABLE_PERCENT * classified)
+    {
+        return "constant";
+    }
+    if (100 * (history->constant + history->strided)
+        >= VALUE_PREDICTABLE_PERCENT * classified)
+    {
+        return "stride";
+    }
+
+    return "random";
+}
+
+static int
+predictor_index(int pc)
+{
+    return (pc / 4) % VALUE_PREDICTOR_ENTRIES;
+}
+
+int
+APEX_predictor_lookup(const APEX_Value_Predictor *pred, int pc, int *value)
+{
+    const Value_Predictor_Entry *entry = &pred->table[predictor_index(pc)];
+
+    if (entry->pc != pc || entry->confidence < VALUE_PREDICTOR_CONFIDENT)
+    {
+        return FALSE;
+    }
+
+    *value = entry->last + entry->stride;
+    return TRUE;
+}
+
+/* The confidence counter goes up when the stride repeats and back to zero
+ * when it changes */
+void
+APEX_predictor_train(APEX_Value_Predictor *pred, int pc, int value)
+{
+    Value_Predictor_Entry *entry = &pred->table[predictor_index(pc)];
+
+    if (entry->pc != pc)
+    {
+        entry->pc = pc;
+        entry->stride = 0;
+        entry->confidence = 0;
+    }
+    else if (value - entry->last == entry->stride)
+    {
+        if (entry->confidence < 3)
+        {
+            entry->confidence++;
+        }
+    }
+    else
+    {
+        entry->stride = value - entry->last;
+        entry->confidence = 0;
+    }
+
+    entry->last = value;
+}
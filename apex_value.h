@@ -0,0 +1,80 @@
+/*
+ * apex_value.h
+ * Contains declarations of the value and address profiler, which classifies
+ * what each instruction produces as constant, stride or random, and of the
+ * stride value predictor modelled behind the value_prediction knob
+ */
+#ifndef _APEX_VALUE_H_
+#define _APEX_VALUE_H_
+
+#include "apex_macros.h"
+
+/* Share of samples, in percent, for a history to be called predictable */
+#define VALUE_PREDICTABLE_PERCENT 90
+
+/* History of one stream of values, a fixed size per instruction however
+ * long the run */
+typedef struct APEX_Value_History
+{
+    int last;
+    int stride;              /* Between the last two samples */
+    unsigned long samples;   /* The first has no class */
+    unsigned long constant;  /* Same as the last */
+    unsigned long strided;   /* Last plus the stride before it */
+    unsigned long random;
+} APEX_Value_History;
+
+/* Per-PC profile of the results written back and the memory addresses */
+typedef struct APEX_Value_Entry
+{
+    APEX_Value_History value;
+    APEX_Value_History address;
+} APEX_Value_Entry;
+
+void APEX_value_sample(APEX_Value_History *history, int value);
+
+/* "constant", "stride" or "random" by VALUE_PREDICTABLE_PERCENT, or "-" for
+ * fewer than two samples */
+const char *APEX_value_class(const APEX_Value_History *history);
+
+/* Entries of the predictor table, direct mapped by pc and tagged */
+#define VALUE_PREDICTOR_ENTRIES 64
+
+/* Confidence, of a 2-bit counter, needed to use a prediction */
+#define VALUE_PREDICTOR_CONFIDENT 2
+
+typedef struct Value_Predictor_Entry
+{
+    int pc;         /* Tag, 0 when free */
+    int last;
+    int stride;
+    int confidence;
+} Value_Predictor_Entry;
+
+/*
+ * Stride value predictor. Decode looks up every instruction that writes a
+ * register as it issues, the prediction travels with it, and writeback
+ * verifies it and trains the table. A decode stall cycle spent waiting on
+ * busy registers whose next writers all carry a prediction is charged to the
+ * lowest of them, and counts as removed if that prediction turns out
+ * correct. The timing of the pipeline is left as it is.
+ */
+typedef struct APEX_Value_Predictor
+{
+    Value_Predictor_Entry table[VALUE_PREDICTOR_ENTRIES];
+    unsigned long waiting[MAX_REG_FILE_SIZE]; /* Stalls charged per register */
+    unsigned long predictions;
+    unsigned long correct;
+    unsigned long stalls_removed;
+    unsigned long stalls_kept;                /* Register waits not removed */
+} APEX_Value_Predictor;
+
+/* Returns TRUE and the predicted result of the instruction at pc in value
+ * if the table is confident */
+int APEX_predictor_lookup(const APEX_Value_Predictor *pred, int pc,
+                          int *value);
+
+/* Trains the entry of pc with the result it wrote back */
+void APEX_predictor_train(APEX_Value_Predictor *pred, int pc, int value);
+
+#endif
@@ -1,13 +1,30 @@
 /*
  * file_parser.c
- * Contains functions to parse input file and create code memory, you can edit
- * this file to add new instructions
+ * Contains the single pass assembler which turns an input file into a program
+ * image, you can edit this file to add new instructions
+ *
+ * Input format, one statement per line:
+ *
+ *   ; comment, "//" works too
+ *   label:  MNEMONIC operand,operand,...
+ *           .data [address]      ; following .word/.space go to data memory
+ *   table:  .word 1, 2, label    ; initialize consecutive data words
+ *           .space 4             ; skip data words
+ *           .text                ; back to code
+ *
+ * Registers are R<n>, immediates #<n> in decimal or a label. Branch targets
+ * may be a numeric offset (#-12) or a label, which is turned into the offset
+ * from the branch. Forward references are patched once the whole file has been read,
+ * so the input is only read once and never held in memory.
  *
  * Author:
  * Copyright (c) 2020, Gaurav Kothari (gkothar1@binghamton.edu)
  * State University of New York at Binghamton
  */
-#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,324 +32,914 @@
 #include "apex_cpu.h"
 #include "apex_macros.h"
 
+/* Operand layouts, in the order they are written */
+#define FMT_NONE 0 /* HALT, NOP */
+#define FMT_RRR 1  /* rd, rs1, rs2 */
+#define FMT_RRI 2  /* rd, rs1, imm */
+#define FMT_RI 3   /* rd, imm */
+#define FMT_SRRI 4 /* rs1, rs2, imm */
+#define FMT_RR 5   /* rs1, rs2 */
+#define FMT_BR 6   /* pc relative imm */
+#define FMT_JUMP 7 /* rs1, imm */
+
+/* How a label reference is patched */
+#define FIXUP_ABSOLUTE 0 /* imm = label value */
+#define FIXUP_RELATIVE 1 /* imm = label value - pc of the instruction */
+#define FIXUP_DATA 2     /* data word = label value */
+
+#define MAX_OPERANDS 4
+
+typedef struct Opcode_Info
+{
+    const char *name;
+    int opcode;
+    int format;
+} Opcode_Info;
+
 /*
- * This function is related to parsing input file
- *
- * Note : You are not supposed to edit this function
+ * Note : you can edit this table to add new instructions
+ */
+static const Opcode_Info opcode_table[] = {
+    {"ADD", OPCODE_ADD, FMT_RRR},     {"SUB", OPCODE_SUB, FMT_RRR},
+    {"MUL", OPCODE_MUL, FMT_RRR},     {"DIV", OPCODE_DIV, FMT_RRR},
+    {"AND", OPCODE_AND, FMT_RRR},     {"OR", OPCODE_OR, FMT_RRR},
+    {"EXOR", OPCODE_XOR, FMT_RRR},    {"ADDL", OPCODE_ADDL, FMT_RRI},
+    {"SUBL", OPCODE_SUBL, FMT_RRI},   {"LOAD", OPCODE_LOAD, FMT_RRI},
+    {"LDI", OPCODE_LDI, FMT_RRI},     {"MOVC", OPCODE_MOVC, FMT_RI},
+    {"STORE", OPCODE_STORE, FMT_SRRI}, {"STI", OPCODE_STI, FMT_SRRI},
+    {"CMP", OPCODE_CMP, FMT_RR},      {"BZ", OPCODE_BZ, FMT_BR},
+    {"BNZ", OPCODE_BNZ, FMT_BR},      {"BP", OPCODE_BP, FMT_BR},
+    {"BNP", OPCODE_BNP, FMT_BR},      {"JUMP", OPCODE_JUMP, FMT_JUMP},
+    {"HALT", OPCODE_HALT, FMT_NONE},  {"NOP", OPCODE_NOP, FMT_NONE},
+};
+
+static const int format_operands[] = {0, 3, 3, 2, 3, 2, 1, 2};
+
+typedef struct Symbol
+{
+    char *name;
+    int value;
+    int defined;
+} Symbol;
+
+typedef struct Fixup
+{
+    int symbol; /* Index into the symbol table */
+    int kind;
+    int index; /* Instruction or data word to patch */
+    int line;
+} Fixup;
+
+typedef struct Assembler
+{
+    const char *filename;
+    int line;
+    int errors;
+
+    /* Output, grown geometrically */
+    APEX_Instruction *code;
+    APEX_Opcode_Str *opcode_str;
+    int size;
+    int capacity;
+    APEX_Data_Word *data;
+    int data_size;
+    int data_capacity;
+    int num_regs; /* Highest register used plus one */
+
+    /* Location counters */
+    int in_data;
+    int data_address;
+
+    /* Labels, open addressing hash of symbol indices */
+    Symbol *symbols;
+    int num_symbols;
+    int symbol_capacity;
+    int *hash;
+    int hash_size;
+
+    Fixup *fixups;
+    int num_fixups;
+    int fixup_capacity;
+} Assembler;
+
+static void
+asm_error(Assembler *as, const char *fmt, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "%s:%d: error: ", as->filename, as->line);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    as->errors++;
+}
+
+/*
+ * Makes room for one more element, doubling the buffer when it is full
  */
 static int
-get_num_from_string(const char *buffer)
+grow(void **buffer, int *capacity, int used, size_t elem_size)
+{
+    void *p;
+    int new_capacity;
+
+    if (used < *capacity)
+    {
+        return 0;
+    }
+
+    new_capacity = *capacity ? *capacity * 2 : 64;
+    p = realloc(*buffer, new_capacity * elem_size);
+    if (!p)
+    {
+        return -1;
+    }
+
+    *buffer = p;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static unsigned int
+hash_name(const char *name)
 {
-    char str[16];
-    int i, j = 0;
+    unsigned int h = 2166136261u;
 
-    for (i = 1; buffer[i] != '\0'; ++i)
+    while (*name)
     {
-        str[j] = buffer[i];
-        j++;
+        h = (h ^ (unsigned char)*name++) * 16777619u;
     }
-    str[j] = '\0';
 
-    return atoi(str);
+    return h;
+}
+
+static int
+rehash(Assembler *as, int new_size)
+{
+    int i, slot;
+    int *hash = malloc(new_size * sizeof(int));
+
+    if (!hash)
+    {
+        return -1;
+    }
+
+    memset(hash, -1, new_size * sizeof(int));
+    for (i = 0; i < as->num_symbols; ++i)
+    {
+        slot = hash_name(as->symbols[i].name) & (new_size - 1);
+        while (hash[slot] != -1)
+        {
+            slot = (slot + 1) & (new_size - 1);
+        }
+        hash[slot] = i;
+    }
+
+    free(as->hash);
+    as->hash = hash;
+    as->hash_size = new_size;
+    return 0;
 }
 
 /*
- * This function sets the numeric opcode to an instruction based on string value
- *
- * Note : you can edit this function to add new instructions
+ * Returns the index of the named symbol, adding it undefined if it is new
  */
 static int
-set_opcode_str(const char *opcode_str)
+lookup_symbol(Assembler *as, const char *name)
 {
-    if (strcmp(opcode_str, "ADD") == 0)
+    int slot, index;
+
+    if (as->num_symbols * 2 >= as->hash_size
+        && rehash(as, as->hash_size ? as->hash_size * 2 : 256) != 0)
     {
-        return OPCODE_ADD;
+        return -1;
     }
 
-    if (strcmp(opcode_str, "SUB") == 0)
+    slot = hash_name(name) & (as->hash_size - 1);
+    while ((index = as->hash[slot]) != -1)
     {
-        return OPCODE_SUB;
+        if (strcmp(as->symbols[index].name, name) == 0)
+        {
+            return index;
+        }
+        slot = (slot + 1) & (as->hash_size - 1);
     }
 
-    if (strcmp(opcode_str, "MUL") == 0)
+    if (grow((void **)&as->symbols, &as->symbol_capacity, as->num_symbols,
+             sizeof(Symbol))
+        != 0)
     {
-        return OPCODE_MUL;
+        return -1;
     }
 
-    if (strcmp(opcode_str, "DIV") == 0)
+    index = as->num_symbols;
+    as->symbols[index].name = strdup(name);
+    if (!as->symbols[index].name)
     {
-        return OPCODE_DIV;
+        return -1;
     }
+    as->symbols[index].value = 0;
+    as->symbols[index].defined = FALSE;
+    as->num_symbols++;
+    as->hash[slot] = index;
+    return index;
+}
+
+static int
+is_ident_start(char c)
+{
+    return isalpha((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
 
-    if (strcmp(opcode_str, "ADDL") == 0)
+static int
+is_ident_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '.' || c == '$';
+}
+
+static int
+is_identifier(const char *s)
+{
+    if (!is_ident_start(*s))
     {
-        return OPCODE_ADDL;
+        return FALSE;
     }
 
-    if (strcmp(opcode_str, "SUBL") == 0)
+    while (*++s)
     {
-        return OPCODE_SUBL;
+        if (!is_ident_char(*s))
+        {
+            return FALSE;
+        }
     }
 
+    return TRUE;
+}
+
+static char *
+trim(char *s)
+{
+    char *end;
 
-    if (strcmp(opcode_str, "AND") == 0)
+    while (isspace((unsigned char)*s))
     {
-        return OPCODE_AND;
+        s++;
     }
 
-    if (strcmp(opcode_str, "OR") == 0)
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1]))
     {
-        return OPCODE_OR;
+        *--end = '\0';
     }
 
-    if (strcmp(opcode_str, "EXOR") == 0)
+    return s;
+}
+
+/*
+ * Splits a comma separated operand list in place, returns the count or -1 if
+ * there are more than max_operands
+ */
+static int
+split_operands(char *s, char **operands, int max_operands)
+{
+    int n = 0;
+    char *comma;
+
+    if (*s == '\0')
     {
-        return OPCODE_XOR;
+        return 0;
     }
 
-    if (strcmp(opcode_str, "MOVC") == 0)
+    while (TRUE)
     {
-        return OPCODE_MOVC;
+        if (n == max_operands)
+        {
+            return -1;
+        }
+
+        comma = strchr(s, ',');
+        if (comma)
+        {
+            *comma = '\0';
+        }
+        operands[n++] = trim(s);
+
+        if (!comma)
+        {
+            return n;
+        }
+        s = comma + 1;
     }
+}
 
-    if (strcmp(opcode_str, "LOAD") == 0)
+static void
+add_fixup(Assembler *as, const char *name, int kind, int index)
+{
+    int symbol = lookup_symbol(as, name);
+
+    if (symbol < 0
+        || grow((void **)&as->fixups, &as->fixup_capacity, as->num_fixups,
+                sizeof(Fixup))
+               != 0)
     {
-        return OPCODE_LOAD;
+        asm_error(as, "out of memory");
+        return;
     }
 
-    if (strcmp(opcode_str, "STORE") == 0)
+    as->fixups[as->num_fixups].symbol = symbol;
+    as->fixups[as->num_fixups].kind = kind;
+    as->fixups[as->num_fixups].index = index;
+    as->fixups[as->num_fixups].line = as->line;
+    as->num_fixups++;
+}
+
+static int
+parse_register(Assembler *as, const char *tok, int *reg)
+{
+    char *end;
+    long num;
+
+    if ((tok[0] != 'R' && tok[0] != 'r') || !isdigit((unsigned char)tok[1]))
     {
-        return OPCODE_STORE;
+        asm_error(as, "expected a register, found '%s'", tok);
+        return -1;
     }
 
-    if (strcmp(opcode_str, "LDI") == 0)
+    num = strtol(tok + 1, &end, 10);
+    if (*end != '\0')
     {
-        return OPCODE_LDI;
+        asm_error(as, "expected a register, found '%s'", tok);
+        return -1;
     }
 
-    if (strcmp(opcode_str, "STI") == 0)
+    if (num >= MAX_REG_FILE_SIZE)
     {
-        return OPCODE_STI;
+        asm_error(as, "register %s out of range, the last is R%d", tok,
+                  MAX_REG_FILE_SIZE - 1);
+        return -1;
     }
 
-    if (strcmp(opcode_str, "BZ") == 0)
+    if (num >= as->num_regs)
     {
-        return OPCODE_BZ;
+        as->num_regs = (int)num + 1;
     }
 
-    if (strcmp(opcode_str, "BNZ") == 0)
+    *reg = (int)num;
+    return 0;
+}
+
+/* Results of parse_number */
+#define NUMBER_OK 0
+#define NUMBER_MALFORMED -1
+#define NUMBER_OUT_OF_RANGE -2
+
+/*
+ * Reads tok as a decimal number in min to max. Numbers are always decimal,
+ * as they were when immediates went through atoi, so "#010" is ten.
+ */
+static int
+parse_number(const char *tok, long min, long max, int *value)
+{
+    char *end;
+    long num;
+
+    errno = 0;
+    num = strtol(tok, &end, 10);
+    if (end == tok || *end != '\0')
+    {
+        return NUMBER_MALFORMED;
+    }
+    if (errno == ERANGE || num < min || num > max)
     {
-        return OPCODE_BNZ;
+        return NUMBER_OUT_OF_RANGE;
     }
 
-    if (strcmp(opcode_str, "HALT") == 0 || strcmp(opcode_str, "HALT\n") == 0 )
+    *value = (int)num;
+    return NUMBER_OK;
+}
+
+/*
+ * Parses #<number>, <number>, #label or label. Label references are queued
+ * for patching with the given kind and the number is left at 0.
+ */
+static int
+parse_value(Assembler *as, const char *tok, int *value, int kind, int index)
+{
+    if (*tok == '#')
     {
-        return OPCODE_HALT;
+        tok++;
     }
 
-    if (strcmp(opcode_str, "CMP") == 0)
+    if (is_identifier(tok))
     {
-        return OPCODE_CMP;
+        *value = 0;
+        add_fixup(as, tok, kind, index);
+        return 0;
     }
 
-    if (strcmp(opcode_str, "BP") == 0)
+    switch (parse_number(tok, INT_MIN, INT_MAX, value))
     {
-        return OPCODE_BP;
+        case NUMBER_MALFORMED:
+        {
+            asm_error(as, "expected an immediate or label, found '%s'", tok);
+            return -1;
+        }
+
+        case NUMBER_OUT_OF_RANGE:
+        {
+            asm_error(as, "immediate '%s' does not fit in 32 bits", tok);
+            return -1;
+        }
     }
 
-    if (strcmp(opcode_str, "BNP") == 0)
+    return 0;
+}
+
+static void
+define_label(Assembler *as, const char *name)
+{
+    int symbol = lookup_symbol(as, name);
+
+    if (symbol < 0)
     {
-        return OPCODE_BNP;
+        asm_error(as, "out of memory");
+        return;
     }
 
-    if (strcmp(opcode_str, "NOP\n") == 0 || strcmp(opcode_str, "NOP") == 0)
+    if (as->symbols[symbol].defined)
     {
-        return OPCODE_NOP;
+        asm_error(as, "label '%s' defined twice", name);
+        return;
     }
 
-    if (strcmp(opcode_str, "JUMP\n") == 0 || strcmp(opcode_str, "JUMP") == 0)
+    as->symbols[symbol].defined = TRUE;
+    as->symbols[symbol].value
+        = as->in_data ? as->data_address : 4000 + as->size * 4;
+}
+
+static void
+emit_data_word(Assembler *as, const char *tok)
+{
+    APEX_Data_Word *word;
+
+    if (as->data_address < 0 || as->data_address >= DATA_MEMORY_SIZE)
     {
-        return OPCODE_JUMP;
+        asm_error(as, "data address %d outside data memory", as->data_address);
+        return;
     }
 
-    
+    if (grow((void **)&as->data, &as->data_capacity, as->data_size,
+             sizeof(APEX_Data_Word))
+        != 0)
+    {
+        asm_error(as, "out of memory");
+        return;
+    }
 
-    assert(0 && "Invalid opcode");
-    return 0;
+    word = &as->data[as->data_size];
+    word->address = as->data_address;
+    if (parse_value(as, tok, &word->value, FIXUP_DATA, as->data_size) == 0)
+    {
+        as->data_size++;
+        as->data_address++;
+    }
 }
 
 static void
-split_opcode_from_insn_string(char *buffer, char tokens[2][128])
+parse_directive(Assembler *as, char *s)
 {
-    int token_num = 0;
+    char *operands[1];
+    char *args;
+    int n, value;
+    char *end;
+
+    for (args = s; *args && !isspace((unsigned char)*args); ++args)
+    {
+    }
+    if (*args)
+    {
+        *args++ = '\0';
+    }
+    args = trim(args);
+
+    if (strcmp(s, ".text") == 0)
+    {
+        as->in_data = FALSE;
+        return;
+    }
+
+    if (strcmp(s, ".data") == 0)
+    {
+        as->in_data = TRUE;
+        if (*args)
+        {
+            if (parse_number(args, 0, DATA_MEMORY_SIZE - 1, &value)
+                != NUMBER_OK)
+            {
+                asm_error(as, "expected a data address 0 to %d, found '%s'",
+                          DATA_MEMORY_SIZE - 1, args);
+                return;
+            }
+            as->data_address = value;
+        }
+        return;
+    }
 
-    char *token = strtok(buffer, " ");
+    if (!as->in_data)
+    {
+        asm_error(as, "'%s' outside of a .data section", s);
+        return;
+    }
+
+    if (strcmp(s, ".word") == 0)
+    {
+        if (*args == '\0')
+        {
+            asm_error(as, ".word needs at least one value");
+            return;
+        }
+
+        /* Values are consumed one at a time so long lists need no table */
+        while (*args)
+        {
+            end = strchr(args, ',');
+            if (end)
+            {
+                *end = '\0';
+            }
+            emit_data_word(as, trim(args));
+            if (!end)
+            {
+                break;
+            }
+            args = end + 1;
+        }
+        return;
+    }
 
-    while (token != NULL)
+    if (strcmp(s, ".space") == 0)
     {
-        strcpy(tokens[token_num], token);
-        token_num++;
-        token = strtok(NULL, " ");
+        n = split_operands(args, operands, 1);
+        if (n != 1
+            || parse_number(operands[0], 0, DATA_MEMORY_SIZE, &value)
+                   != NUMBER_OK)
+        {
+            asm_error(as, ".space needs a word count, at most %d",
+                      DATA_MEMORY_SIZE);
+            return;
+        }
+        as->data_address += value;
+        return;
     }
+
+    asm_error(as, "unknown directive '%s'", s);
+}
+
+static const Opcode_Info *
+find_opcode(const char *mnemonic)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(opcode_table) / sizeof(opcode_table[0]); ++i)
+    {
+        if (strcasecmp(opcode_table[i].name, mnemonic) == 0)
+        {
+            return &opcode_table[i];
+        }
+    }
+
+    return NULL;
 }
 
 /*
- * This function is related to parsing input file
+ * Assembles one instruction into the next code memory slot
  *
  * Note : you can edit this function to add new instructions
  */
 static void
-create_APEX_instruction(APEX_Instruction *ins, char *buffer)
+parse_instruction(Assembler *as, char *s)
 {
-    int i, token_num = 0;
-    char tokens[6][128];
-    char top_level_tokens[2][128];
+    const Opcode_Info *info;
+    APEX_Instruction *ins;
+    APEX_Opcode_Str *text;
+    char *operands[MAX_OPERANDS];
+    char *args;
+    int n, rd = 0, rs1 = 0, rs2 = 0, imm = 0, err = 0;
+    int capacity, index = as->size;
 
-    for (i = 0; i < 2; ++i)
+    if (as->in_data)
     {
-        strcpy(top_level_tokens[i], "");
+        asm_error(as, "instruction in a .data section");
+        return;
     }
 
-    split_opcode_from_insn_string(buffer, top_level_tokens);
-
-    char *token = strtok(top_level_tokens[1], ",");
+    for (args = s; *args && !isspace((unsigned char)*args); ++args)
+    {
+    }
+    if (*args)
+    {
+        *args++ = '\0';
+    }
 
-    while (token != NULL)
+    info = find_opcode(s);
+    if (!info)
     {
-        strcpy(tokens[token_num], token);
-        token_num++;
-        token = strtok(NULL, ",");
+        asm_error(as, "unknown instruction '%s'", s);
+        return;
     }
 
-    strcpy(ins->opcode_str, top_level_tokens[0]);
-    ins->opcode = set_opcode_str(ins->opcode_str);
+    n = split_operands(trim(args), operands, MAX_OPERANDS);
+    if (n != format_operands[info->format])
+    {
+        asm_error(as, "%s takes %d operand(s)", info->name,
+                  format_operands[info->format]);
+        return;
+    }
 
-    switch (ins->opcode)
+    switch (info->format)
     {
-        case OPCODE_ADD:
-        case OPCODE_SUB:
-        case OPCODE_MUL:
-        case OPCODE_DIV:
-        case OPCODE_AND:
-        case OPCODE_OR:
-        case OPCODE_XOR:
+        case FMT_RRR:
         {
-            ins->rd = get_num_from_string(tokens[0]);
-            ins->rs1 = get_num_from_string(tokens[1]);
-            ins->rs2 = get_num_from_string(tokens[2]);
+            err = parse_register(as, operands[0], &rd)
+                 | parse_register(as, operands[1], &rs1)
+                 | parse_register(as, operands[2], &rs2);
             break;
         }
 
-        case OPCODE_ADDL:
-        case OPCODE_SUBL:
-        case OPCODE_LOAD:
-        case OPCODE_LDI:
+        case FMT_RRI:
         {
-            ins->rd = get_num_from_string(tokens[0]);
-            ins->rs1 = get_num_from_string(tokens[1]);
-            ins->imm = get_num_from_string(tokens[2]);
+            err = parse_register(as, operands[0], &rd)
+                 | parse_register(as, operands[1], &rs1)
+                 | parse_value(as, operands[2], &imm, FIXUP_ABSOLUTE, index);
             break;
         }
 
-        case OPCODE_MOVC:
+        case FMT_RI:
         {
-            ins->rd = get_num_from_string(tokens[0]);
-            ins->imm = get_num_from_string(tokens[1]);
+            err = parse_register(as, operands[0], &rd)
+                 | parse_value(as, operands[1], &imm, FIXUP_ABSOLUTE, index);
             break;
         }
 
-        case OPCODE_STORE:
-        case OPCODE_STI:
+        case FMT_SRRI:
         {
-            ins->rs1 = get_num_from_string(tokens[0]);
-            ins->rs2 = get_num_from_string(tokens[1]);
-            ins->imm = get_num_from_string(tokens[2]);
+            err = parse_register(as, operands[0], &rs1)
+                 | parse_register(as, operands[1], &rs2)
+                 | parse_value(as, operands[2], &imm, FIXUP_ABSOLUTE, index);
             break;
         }
 
-        case OPCODE_CMP:
+        case FMT_RR:
         {
-            ins->rs1 = get_num_from_string(tokens[0]);
-            ins->rs2 = get_num_from_string(tokens[1]);
+            err = parse_register(as, operands[0], &rs1)
+                 | parse_register(as, operands[1], &rs2);
             break;
         }
 
-        case OPCODE_NOP:
+        case FMT_BR:
         {
+            err = parse_value(as, operands[0], &imm, FIXUP_RELATIVE, index);
             break;
         }
 
-        case OPCODE_BZ:
-        case OPCODE_BNZ:
-        case OPCODE_BP:
-        case OPCODE_BNP:
+        case FMT_JUMP:
         {
-            ins->imm = get_num_from_string(tokens[0]);
+            err = parse_register(as, operands[0], &rs1)
+                 | parse_value(as, operands[1], &imm, FIXUP_ABSOLUTE, index);
             break;
         }
+    }
 
-        case OPCODE_JUMP:
+    if (err != 0)
+    {
+        return;
+    }
+
+    /* The mnemonic side table always has the same capacity as the code */
+    capacity = as->capacity;
+    if (grow((void **)&as->code, &as->capacity, as->size,
+             sizeof(APEX_Instruction))
+        != 0)
+    {
+        asm_error(as, "out of memory");
+        return;
+    }
+
+    if (as->capacity != capacity)
+    {
+        text = realloc(as->opcode_str, as->capacity * sizeof(APEX_Opcode_Str));
+        if (!text)
         {
-            ins->rs1 = get_num_from_string(tokens[0]);
-            ins->imm = get_num_from_string(tokens[1]);
+            asm_error(as, "out of memory");
+            return;
         }
-    }
-    /* Fill in rest of the instructions accordingly */
+        as->opcode_str = text;
+    }
+
+    ins = &as->code[index];
+    memset(ins, 0, sizeof(APEX_Instruction));
+    ins->opcode = info->opcode;
+    ins->rd = rd;
+    ins->rs1 = rs1;
+    ins->rs2 = rs2;
+    ins->imm = imm;
+    strcpy(as->opcode_str[index], info->name);
+    as->size++;
 }
 
-/*
- * This function is related to parsing input file
- *
- * Note : You are not supposed to edit this function
- */
-APEX_Instruction *
-create_code_memory(const char *filename, int *size)
+static void
+parse_line(Assembler *as, char *line)
 {
-    FILE *fp;
-    ssize_t nread;
-    size_t len = 0;
-    char *line = NULL;
-    int code_memory_size = 0;
-    int current_instruction = 0;
-    APEX_Instruction *code_memory;
+    char *s, *p;
 
-    if (!filename)
+    /* Strip comments */
+    for (p = line; *p; ++p)
     {
-        return NULL;
+        if (*p == ';' || (p[0] == '/' && p[1] == '/'))
+        {
+            *p = '\0';
+            break;
+        }
     }
 
-    fp = fopen(filename, "r");
-    if (!fp)
+    s = trim(line);
+
+    /* Leading label */
+    for (p = s; is_ident_char(*p); ++p)
+    {
+    }
+    if (*p == ':' && p != s && is_ident_start(*s))
+    {
+        *p = '\0';
+        define_label(as, s);
+        s = trim(p + 1);
+    }
+
+    if (*s == '\0')
     {
-        return NULL;
+        return;
     }
 
-    while ((nread = getline(&line, &len, fp)) != -1)
+    if (*s == '.')
     {
-        code_memory_size++;
+        parse_directive(as, s);
     }
-    *size = code_memory_size;
-    if (!code_memory_size)
+    else
     {
-        fclose(fp);
-        return NULL;
+        parse_instruction(as, s);
     }
+}
+
+static void
+resolve_fixups(Assembler *as)
+{
+    int i;
+    const Fixup *fixup;
+    const Symbol *symbol;
+
+    for (i = 0; i < as->num_fixups; ++i)
+    {
+        fixup = &as->fixups[i];
+        symbol = &as->symbols[fixup->symbol];
+
+        if (!symbol->defined)
+        {
+            as->line = fixup->line;
+            asm_error(as, "undefined label '%s'", symbol->name);
+            continue;
+        }
+
+        switch (fixup->kind)
+        {
+            case FIXUP_ABSOLUTE:
+            {
+                as->code[fixup->index].imm = symbol->value;
+                break;
+            }
+
+            case FIXUP_RELATIVE:
+            {
+                as->code[fixup->index].imm
+                    = symbol->value - (4000 + fixup->index * 4);
+                break;
+            }
+
+            case FIXUP_DATA:
+            {
+                as->data[fixup->index].value = symbol->value;
+                break;
+            }
+        }
+    }
+}
+
+static void
+free_assembler(Assembler *as)
+{
+    int i;
+
+    for (i = 0; i < as->num_symbols; ++i)
+    {
+        free(as->symbols[i].name);
+    }
+    free(as->symbols);
+    free(as->hash);
+    free(as->fixups);
+}
+
+/*
+ * Resolves labels and hands the output buffers over to program.
+ * Returns 0 on success, -1 if there was any error.
+ */
+static int
+finish_program(Assembler *as, APEX_Program *program)
+{
+    resolve_fixups(as);
 
-    code_memory = calloc(code_memory_size, sizeof(APEX_Instruction));
-    if (!code_memory)
+    if (!as->errors && as->size == 0)
     {
-        fclose(fp);
-        return NULL;
+        asm_error(as, "no instructions");
     }
 
-    rewind(fp);
-    while ((nread = getline(&line, &len, fp)) != -1)
+    free_assembler(as);
+
+    if (as->errors)
     {
-        create_APEX_instruction(&code_memory[current_instruction], line);
-        current_instruction++;
+        free(as->code);
+        free(as->opcode_str);
+        free(as->data);
+        return -1;
     }
 
+    program->code_memory = as->code;
+    program->opcode_str = as->opcode_str;
+    program->size = as->size;
+    program->data = as->data;
+    program->data_size = as->data_size;
+    program->num_regs = as->num_regs;
+    return 0;
+}
+
+/*
+ * Assembles the stream fp into program, used for pipes and stdin. The name
+ * is only used in diagnostics, which go to stderr as "name:line: error: ...".
+ * Returns 0 on success, -1 if there was any error.
+ */
+int
+assemble_program(FILE *fp, const char *name, APEX_Program *program)
+{
+    Assembler as;
+    char *line = NULL;
+    size_t len = 0;
+
+    memset(&as, 0, sizeof(as));
+    as.filename = name;
+
+    while (getline(&line, &len, fp) != -1)
+    {
+        as.line++;
+        parse_line(&as, line);
+    }
     free(line);
-    fclose(fp);
-    return code_memory;
-}
\ No newline at end of file
+
+    return finish_program(&as, program);
+}
+
+/*
+ * Assembles len bytes of text, typically a private mapping of the input file.
+ * Lines are tokenized where they are: every newline is overwritten with a
+ * terminator, so buffer[len] must be writable as well.
+ * Returns 0 on success, -1 if there was any error.
+ */
+int
+assemble_buffer(char *buffer, size_t len, const char *name,
+                APEX_Program *program)
+{
+    Assembler as;
+    char *line, *next, *newline;
+    char *end = buffer + len;
+
+    memset(&as, 0, sizeof(as));
+    as.filename = name;
+    *end = '\0';
+
+    for (line = buffer; line < end; line = next)
+    {
+        newline = memchr(line, '\n', end - line);
+        if (newline)
+        {
+            *newline = '\0';
+            next = newline + 1;
+        }
+        else
+        {
+            next = end;
+        }
+
+        as.line++;
+        parse_line(&as, line);
+    }
+
+    return finish_program(&as, program);
+}
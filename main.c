@@ -7,30 +7,492 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "apex_cpu.h"
+#include "apex_debugger.h"
+#include "apex_sweep.h"
+#include "apex_system.h"
+
+#define MAX_SWEEP_AXES 16
+
+static void
+print_usage(const char *prog)
+{
+    fprintf(stderr, "APEX_Help: Usage %s [options] <input_file | ->\n"
+                    "       %s [options] -t <trace_file>\n"
+                    "       %s [options] -M <input_file>...\n",
+            prog, prog, prog);
+    fprintf(stderr,
+            "  -p <file>      Write per-PC hot-spot profile ('-' for stdout)\n"
+            "  -L <file>      Write stage latency histograms and occupancy\n"
+            "  -E <file>      Write an activity-based energy estimate\n"
+            "  -e <file>      Energy coefficients for -E, '<event> <pJ>' lines\n"
+            "  -V <file>      Write per-PC value and address predictability\n"
+            "  -r <file>      Write the final counts, registers, flags and a\n"
+            "                 data memory checksum\n"
+            "  -s <target>    Publish statistics every snapshot_interval cycles\n"
+            "                 to a file, '-' or unix:<socket_path>\n"
+            "  -H             Headless, no per-cycle output or single-step\n"
+            "  -d             Interactive debugger\n"
+            "  -c key=value   Set a configuration knob\n"
+            "  -S <csv_file>  Parameter sweep over the -g axes ('-' for stdout)\n"
+            "  -g key=values  Sweep axis, values as v1,v2,... or first:last[:step]\n"
+            "  -j <threads>   Sweep threads, default one per core, or -M\n"
+            "                 threads, default 1\n"
+            "  -t <trace>     Replay a recorded instruction trace\n"
+            "  -T <trace>     Record retired instructions to a trace\n"
+            "  -M             Multi-core, one core per input file sharing\n"
+            "                 data memory\n"
+            "  Configuration knobs:\n");
+    APEX_config_print_keys(stderr);
+}
+
+static FILE *
+open_output(const char *name)
+{
+    if (strcmp(name, "-") == 0)
+    {
+        return stdout;
+    }
+
+    return fopen(name, "w");
+}
+
+static void
+close_output(FILE *fp)
+{
+    if (fp != stdout)
+    {
+        fclose(fp);
+    }
+    else
+    {
+        fflush(fp);
+    }
+}
+
+static int
+run_system(char **files, int num_cores, const APEX_Config *config,
+           int num_threads)
+{
+    APEX_Program **programs;
+    APEX_System *system;
+    int i, ret = 1;
+
+    programs = calloc(num_cores, sizeof(APEX_Program *));
+    if (!programs)
+    {
+        return 1;
+    }
+
+    for (i = 0; i < num_cores; ++i)
+    {
+        programs[i] = APEX_program_load(files[i]);
+        if (!programs[i])
+        {
+            fprintf(stderr, "APEX_Error: Unable to load %s\n", files[i]);
+            goto out;
+        }
+    }
+
+    /* The cores hold their own references to the programs */
+    system = APEX_system_create(programs, (const char *const *)files,
+                                num_cores, config);
+    if (!system)
+    {
+        fprintf(stderr, "APEX_Error: Unable to initialize system\n");
+        goto out;
+    }
+
+    APEX_system_run(system, num_threads);
+    if (!config->quiet)
+    {
+        APEX_system_print(system, stdout);
+    }
+    APEX_system_free(system);
+    ret = 0;
+
+out:
+    for (i = 0; i < num_cores; ++i)
+    {
+        APEX_program_release(programs[i]);
+    }
+    free(programs);
+    return ret;
+}
+
+static int
+run_sweep(const char *filename, const APEX_Config *config, char **axes,
+          int num_axes, int num_threads, const char *csv_file)
+{
+    APEX_Program *program;
+    FILE *csv;
+    int ret;
+
+    /* Parse once, every sweep point shares the same program image */
+    program = APEX_program_load(filename);
+    if (!program)
+    {
+        fprintf(stderr, "APEX_Error: Unable to load %s\n", filename);
+        return 1;
+    }
+
+    csv = open_output(csv_file);
+    if (!csv)
+    {
+        fprintf(stderr, "APEX_Error: Unable to open %s\n", csv_file);
+        APEX_program_release(program);
+        return 1;
+    }
+
+    ret = APEX_sweep_run(program, config, axes, num_axes, num_threads, csv);
+    close_output(csv);
+    APEX_program_release(program);
+    return ret ? 1 : 0;
+}
 
 int
-main(int argc, char const *argv[])
+main(int argc, char *argv[])
 {
     APEX_CPU *cpu;
+    APEX_Config config;
+    FILE *fp;
+    const char *profile_file = NULL;
+    const char *latency_file = NULL;
+    const char *result_file = NULL;
+    const char *values_file = NULL;
+    const char *energy_file = NULL;
+    const char *coefficients_file = NULL;
+    const char *snapshot_target = NULL;
+    const char *sweep_file = NULL;
+    const char *trace_file = NULL;
+    const char *record_file = NULL;
+    char *axes[MAX_SWEEP_AXES];
+    char *value;
+    int num_axes = 0, num_threads = 0;
+    int debugger = FALSE;
+    int multi_core = FALSE;
+    int opt;
 
     fprintf(stderr, "APEX CPU Pipeline Simulator v%0.1lf\n", VERSION);
 
-    if (argc != 2)
+    APEX_config_default(&config);
+
+    while ((opt = getopt(argc, argv, "p:L:E:e:V:r:s:Hdc:S:g:j:t:T:M")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p':
+            {
+                profile_file = optarg;
+                break;
+            }
+
+            case 'L':
+            {
+                latency_file = optarg;
+                break;
+            }
+
+            case 'E':
+            {
+                energy_file = optarg;
+                break;
+            }
+
+            case 'e':
+            {
+                coefficients_file = optarg;
+                break;
+            }
+
+            case 'V':
+            {
+                values_file = optarg;
+                break;
+            }
+
+            case 'r':
+            {
+                result_file = optarg;
+                break;
+            }
+
+            case 's':
+            {
+                snapshot_target = optarg;
+                break;
+            }
+
+            case 'H':
+            {
+                config.debug_messages = 0;
+                config.single_step = 0;
+                break;
+            }
+
+            case 'd':
+            {
+                debugger = TRUE;
+                break;
+            }
+
+            case 'c':
+            {
+                value = strchr(optarg, '=');
+                if (value)
+                {
+                    *value++ = '\0';
+                }
+                if (!value || APEX_config_set(&config, optarg, value) != 0)
+                {
+                    fprintf(stderr, "APEX_Error: Invalid knob '%s'\n", optarg);
+                    exit(1);
+                }
+                break;
+            }
+
+            case 'S':
+            {
+                sweep_file = optarg;
+                break;
+            }
+
+            case 'g':
+            {
+                if (num_axes == MAX_SWEEP_AXES)
+                {
+                    fprintf(stderr, "APEX_Error: Too many sweep axes\n");
+                    exit(1);
+                }
+                axes[num_axes++] = optarg;
+                break;
+            }
+
+            case 'j':
+            {
+                num_threads = atoi(optarg);
+                break;
+            }
+
+            case 't':
+            {
+                trace_file = optarg;
+                break;
+            }
+
+            case 'T':
+            {
+                record_file = optarg;
+                break;
+            }
+
+            case 'M':
+            {
+                multi_core = TRUE;
+                break;
+            }
+
+            default:
+            {
+                print_usage(argv[0]);
+                exit(1);
+            }
+        }
+    }
+
+    if (multi_core)
+    {
+        if (optind == argc || trace_file || record_file || sweep_file
+            || profile_file || latency_file || energy_file || values_file
+            || result_file || snapshot_target || debugger)
+        {
+            fprintf(stderr, "APEX_Error: -M takes input files and no "
+                            "-t, -T, -S, -p, -L, -E, -V, -r, -s or -d\n");
+            exit(1);
+        }
+        /* One thread unless asked, small systems only pay for barriers */
+        return run_system(argv + optind, argc - optind, &config,
+                          num_threads ? num_threads : 1);
+    }
+
+    /* A trace replaces the program, there is nothing to assemble */
+    if (argc - optind != (trace_file ? 0 : 1))
+    {
+        print_usage(argv[0]);
+        exit(1);
+    }
+
+    if (trace_file && (sweep_file || profile_file || values_file))
+    {
+        fprintf(stderr, "APEX_Error: -S, -p and -V need a program file\n");
+        exit(1);
+    }
+
+    if (sweep_file && (record_file || energy_file || values_file || result_file))
+    {
+        fprintf(stderr, "APEX_Error: -T, -E, -V and -r cover a single run, "
+                        "not a sweep\n");
+        exit(1);
+    }
+
+    if (coefficients_file && !energy_file)
     {
-        fprintf(stderr, "APEX_Help: Usage %s <input_file>\n", argv[0]);
+        fprintf(stderr, "APEX_Error: -e sets the coefficients of -E\n");
         exit(1);
     }
 
-    cpu = APEX_cpu_init(argv[1]);
+    /* A program read from stdin leaves nothing for interactive input */
+    if (!trace_file && strcmp(argv[optind], "-") == 0)
+    {
+        if (debugger)
+        {
+            fprintf(stderr, "APEX_Error: -d needs the program in a file\n");
+            exit(1);
+        }
+        config.single_step = 0;
+    }
+
+    if (sweep_file)
+    {
+        return run_sweep(argv[optind], &config, axes, num_axes, num_threads,
+                         sweep_file);
+    }
+
+    if (trace_file)
+    {
+        cpu = APEX_cpu_init_trace(trace_file, &config);
+    }
+    else
+    {
+        cpu = APEX_cpu_init(argv[optind], &config);
+    }
+
     if (!cpu)
     {
         fprintf(stderr, "APEX_Error: Unable to initialize CPU\n");
         exit(1);
     }
 
-    APEX_cpu_run(cpu);
+    if (profile_file && !APEX_cpu_enable_profile(cpu))
+    {
+        fprintf(stderr, "APEX_Error: Unable to allocate profile counters\n");
+        exit(1);
+    }
+
+    if (latency_file && !APEX_cpu_enable_latency(cpu))
+    {
+        fprintf(stderr, "APEX_Error: Unable to allocate latency statistics\n");
+        exit(1);
+    }
+
+    if (values_file && !APEX_cpu_enable_values(cpu))
+    {
+        fprintf(stderr, "APEX_Error: Unable to allocate value profile\n");
+        exit(1);
+    }
+
+    if (energy_file && !APEX_cpu_enable_energy(cpu, coefficients_file))
+    {
+        fprintf(stderr, "APEX_Error: Unable to set up the energy model\n");
+        exit(1);
+    }
+
+    if (snapshot_target && !APEX_cpu_enable_snapshots(cpu, snapshot_target))
+    {
+        exit(1);
+    }
+
+    if (record_file && !APEX_cpu_record_trace(cpu, record_file))
+    {
+        exit(1);
+    }
+
+    if (debugger)
+    {
+        APEX_debugger_run(cpu);
+    }
+    else
+    {
+        APEX_cpu_run(cpu);
+    }
+
+    if (profile_file)
+    {
+        fp = open_output(profile_file);
+        if (!fp)
+        {
+            fprintf(stderr, "APEX_Error: Unable to open %s\n", profile_file);
+        }
+        else
+        {
+            APEX_cpu_print_profile(cpu, fp);
+            close_output(fp);
+        }
+    }
+
+    if (latency_file)
+    {
+        fp = open_output(latency_file);
+        if (!fp)
+        {
+            fprintf(stderr, "APEX_Error: Unable to open %s\n", latency_file);
+        }
+        else
+        {
+            APEX_latency_print(cpu->latency, fp);
+            close_output(fp);
+        }
+    }
+
+    if (values_file)
+    {
+        fp = open_output(values_file);
+        if (!fp)
+        {
+            fprintf(stderr, "APEX_Error: Unable to open %s\n", values_file);
+        }
+        else
+        {
+            APEX_cpu_print_values(cpu, fp);
+            close_output(fp);
+        }
+    }
+    else if (!config.quiet)
+    {
+        APEX_cpu_print_prediction(cpu, stdout);
+    }
+
+    if (energy_file)
+    {
+        fp = open_output(energy_file);
+        if (!fp)
+        {
+            fprintf(stderr, "APEX_Error: Unable to open %s\n", energy_file);
+        }
+        else
+        {
+            APEX_energy_print(cpu->energy, cpu->insn_completed, fp);
+            close_output(fp);
+        }
+    }
+
+    if (result_file)
+    {
+        fp = open_output(result_file);
+        if (!fp)
+        {
+            fprintf(stderr, "APEX_Error: Unable to open %s\n", result_file);
+        }
+        else
+        {
+            APEX_cpu_print_result(cpu, fp);
+            close_output(fp);
+        }
+    }
+
     APEX_cpu_stop(cpu);
     return 0;
-}
\ No newline at end of file
+}
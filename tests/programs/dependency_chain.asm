@@ -0,0 +1,21 @@
+MOVC R1,#3
+MOVC R2,#5
+MUL R3,R1,R2
+ADD R4,R3,R1
+SUB R5,R4,R2
+DIV R6,R5,R1
+AND R7,R6,R4
+OR R8,R7,R2
+EXOR R9,R8,R3
+CMP R2,R9
+BP #12
+ADDL R10,R10,#1
+BNZ #8
+SUBL R11,R9,#2
+CMP R11,R11
+BZ #8
+MOVC R12,#99
+STI R9,R0,#30
+STI R8,R0,#30
+LDI R13,R0,#26
+HALT
@@ -0,0 +1,21 @@
+; sum a table with labels
+        .data 100
+table:  .word 5, 7, 9, end_marker
+        .space 2
+extra:  .word -3
+        .text
+start:  MOVC R1,#table      // base address
+        MOVC R2,#3
+        MOVC R3,#0
+        MOVC R4,#1
+loop:   LOAD R5,R1,#0
+        ADD R3,R3,R5
+        ADDL R1,R1,#1
+        SUB R2,R2,R4
+        BNZ loop
+
+        MOVC R6,#extra
+        LOAD R7,R6,#0
+        STORE R3,R0,#50
+        HALT
+end_marker:
@@ -0,0 +1,8 @@
+; enough iterations for a recorded trace to hold several sync points
+        MOVC R1,#0
+        MOVC R9,#2500
+loop:   ADDL R1,R1,#3
+        EXOR R2,R1,R9
+        SUBL R9,R9,#1
+        BNZ loop
+        HALT
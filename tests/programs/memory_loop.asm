@@ -0,0 +1,10 @@
+MOVC R1,#0
+MOVC R9,#50
+loop:
+LOAD R2,R1,#0
+ADDL R2,R2,#1
+STORE R2,R1,#0
+LOAD R3,R1,#20
+SUBL R9,R9,#1
+BNZ loop
+HALT
@@ -0,0 +1,22 @@
+MOVC R1,#10
+MOVC R2,#3
+LDI R3,R1,#4
+SUBL R5,R3,#1
+DIV R6,R1,R2
+OR R7,R6,R5
+EXOR R8,R7,R1
+CMP R8,R7
+BP #8
+BNP #8
+ADDL R9,R9,#1
+SUBL R10,R9,#5
+BNZ #-8
+MOVC R11,#4076
+MOVC R12,#1
+MOVC R12,#2
+MOVC R12,#3
+MOVC R12,#4
+JUMP R11,#8
+NOP
+NOP
+HALT
@@ -0,0 +1,11 @@
+; results of -1 used right away, which the bypass does not pass on
+        MOVC R1,#0
+        MOVC R2,#1
+        SUB R3,R1,R2
+        ADD R4,R3,R2
+        SUBL R5,R1,#1
+        MUL R6,R5,R5
+        ADDL R7,R5,#2
+        SUBL R8,R7,#2
+        ADD R9,R8,R8
+        HALT
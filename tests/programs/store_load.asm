@@ -0,0 +1,8 @@
+MOVC R1,#0
+MOVC R2,#7
+STORE R2,R1,#10
+MOVC R3,#9
+STORE R3,R1,#11
+LOAD R4,R1,#10
+LOAD R7,R1,#12
+HALT
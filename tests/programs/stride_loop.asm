@@ -0,0 +1,9 @@
+; an induction variable and a value derived from it, both strided
+        MOVC R1,#0
+        MOVC R9,#40
+loop:   ADDL R1,R1,#4
+        ADD R2,R1,R1
+        LOAD R3,R2,#0
+        SUBL R9,R9,#1
+        BNZ loop
+        HALT
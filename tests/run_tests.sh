@@ -0,0 +1,79 @@
+#!/bin/sh
+#
+# run_tests.sh
+#
+# Runs every test of tests.list headless and in parallel, and compares the
+# -r result of each run with tests/expected/<name>.out. A test whose knobs
+# start with "replay" records a -T trace of its program and checks the -t
+# replay of that trace with the remaining knobs instead.
+#
+# Usage: run_tests.sh [-u] <simulator>
+#   -u  Rewrite the expected results from the simulator instead of comparing
+
+update=0
+if [ "$1" = "-u" ]; then
+    update=1
+    shift
+fi
+
+if [ $# -ne 1 ]; then
+    echo "Usage: $0 [-u] <simulator>" >&2
+    exit 2
+fi
+
+sim=$1
+dir=$(cd "$(dirname "$0")" && pwd)
+out=$(mktemp -d) || exit 2
+trap 'rm -rf "$out"' EXIT
+
+# Launch all the runs, then wait for them together
+grep -v '^#' "$dir/tests.list" | grep -v '^[[:space:]]*$' > "$out/list"
+while read -r name program knobs; do
+    replay=0
+    args=
+    for knob in $knobs; do
+        if [ "$knob" = replay ]; then
+            replay=1
+        else
+            args="$args -c $knob"
+        fi
+    done
+    # $args is split on purpose, knobs hold no spaces
+    if [ $replay -eq 1 ]; then
+        ("$sim" -H -c quiet=1 -T "$out/$name.trace" \
+            "$dir/programs/$program" &&
+         "$sim" -H -c quiet=1 $args -r "$out/$name.out" \
+            -t "$out/$name.trace") > "$out/$name.log" 2>&1 &
+    else
+        "$sim" -H -c quiet=1 $args -r "$out/$name.out" \
+            "$dir/programs/$program" > "$out/$name.log" 2>&1 &
+    fi
+done < "$out/list"
+wait
+
+passed=0
+failed=0
+while read -r name program knobs; do
+    if [ ! -s "$out/$name.out" ]; then
+        echo "FAIL $name: no result"
+        sed 's/^/    /' "$out/$name.log"
+        failed=$((failed + 1))
+    elif [ $update -eq 1 ]; then
+        cp "$out/$name.out" "$dir/expected/$name.out"
+        passed=$((passed + 1))
+    elif diff -u "$dir/expected/$name.out" "$out/$name.out" \
+            > "$out/$name.diff" 2>&1; then
+        passed=$((passed + 1))
+    else
+        echo "FAIL $name ($program $knobs)"
+        sed 's/^/    /' "$out/$name.diff"
+        failed=$((failed + 1))
+    fi
+done < "$out/list"
+
+if [ $update -eq 1 ]; then
+    echo "Updated $passed expected results, $failed failed"
+else
+    echo "$passed passed, $failed failed"
+fi
+[ $failed -eq 0 ]